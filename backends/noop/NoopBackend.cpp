@@ -27,5 +27,18 @@ HistogramId CreateHistogram(const std::string&, const std::string&, const std::v
 }
 
 void HistogramObserve(HistogramId, double) noexcept {}
+void HistogramObserveTicks(HistogramId, std::uint64_t) noexcept {}
+
+SummaryId CreateSummary(const std::string&, const std::string&, const std::map<std::string, std::string>&) noexcept {
+  return 0;
+}
+
+void SummaryObserve(SummaryId, double) noexcept {}
+void RecordBatch(const BatchOp*, std::size_t) noexcept {}
+
+bool ResolveFamily(MetricKind, const std::string&, const std::vector<std::string>&, std::vector<std::uint64_t>&,
+                   std::vector<std::uint32_t>&) noexcept {
+  return false;
+}
 
 } // namespace promkit
@@ -0,0 +1,428 @@
+#include "Exposition.hpp"
+
+#include <prometheus/metric_type.h>
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <string_view>
+
+namespace promkit {
+
+namespace {
+
+using prometheus::MetricType;
+
+// Line kinds: how the value word is formatted, and whether a timestamp word follows.
+constexpr std::uint8_t kDouble = 0;
+constexpr std::uint8_t kCount = 1;
+constexpr std::uint8_t kStamped = 0x80;
+
+template <typename T>
+std::uint64_t Bits(T v) {
+  return std::bit_cast<std::uint64_t>(v);
+}
+
+void AppendDouble(std::string& s, double d) {
+  if (std::isnan(d)) {
+    s += "NaN";
+  } else if (std::isinf(d)) {
+    s += d > 0 ? "+Inf" : "-Inf";
+  } else {
+    char buf[32];
+    const auto r = std::to_chars(buf, buf + sizeof(buf), d); // shortest round-trip form
+    s.append(buf, r.ptr);
+  }
+}
+
+template <typename Int>
+void AppendInt(std::string& s, Int v) {
+  char buf[24];
+  const auto r = std::to_chars(buf, buf + sizeof(buf), v);
+  s.append(buf, r.ptr);
+}
+
+// Label values escape \ " and newline; help text escapes \ and newline.
+void AppendEscaped(std::string& s, std::string_view v, bool quotes) {
+  for (char c : v) {
+    if (c == '\\') s += "\\\\";
+    else if (c == '\n') s += "\\n";
+    else if (c == '"' && quotes) s += "\\\"";
+    else s += c;
+  }
+}
+
+void AppendLine(std::string& s, std::string_view name, std::string_view suffix, const prometheus::ClientMetric& m,
+                std::string_view extra = {}, double extra_value = 0) {
+  s.append(name);
+  s.append(suffix);
+  if (!m.label.empty() || !extra.empty()) {
+    s += '{';
+    bool first = true;
+    for (const auto& l : m.label) {
+      if (!first) s += ',';
+      first = false;
+      s.append(l.name);
+      s += "=\"";
+      AppendEscaped(s, l.value, true);
+      s += '"';
+    }
+    if (!extra.empty()) {
+      if (!first) s += ',';
+      s.append(extra);
+      s += "=\"";
+      AppendDouble(s, extra_value);
+      s += '"';
+    }
+    s += '}';
+  }
+  s += ' ';
+}
+
+void PutShape(std::string& shape, std::string_view v) {
+  const auto n = static_cast<std::uint32_t>(v.size());
+  shape.append(reinterpret_cast<const char*>(&n), sizeof(n));
+  shape.append(v);
+}
+
+void PutShape(std::string& shape, std::uint64_t w) { shape.append(reinterpret_cast<const char*>(&w), sizeof(w)); }
+
+// What a template depends on (labels, bounds, quantiles, timestamp presence)
+// and the value words, both in line order.
+void Scan(const prometheus::MetricFamily& f, std::string& shape, std::vector<std::uint64_t>& values) {
+  shape.clear();
+  values.clear();
+  for (const auto& m : f.metric) {
+    const bool stamped = m.timestamp_ms != 0;
+    auto put = [&](std::uint64_t w) {
+      values.push_back(w);
+      if (stamped) values.push_back(Bits(m.timestamp_ms));
+    };
+    PutShape(shape, (stamped ? 1ull << 32 : 0) | m.label.size());
+    for (const auto& l : m.label) {
+      PutShape(shape, l.name);
+      PutShape(shape, l.value);
+    }
+    switch (f.type) {
+      case MetricType::Counter: put(Bits(m.counter.value)); break;
+      case MetricType::Gauge: put(Bits(m.gauge.value)); break;
+      case MetricType::Untyped: put(Bits(m.untyped.value)); break;
+      case MetricType::Info: put(Bits(m.info.value)); break;
+      case MetricType::Summary:
+        put(m.summary.sample_count);
+        put(Bits(m.summary.sample_sum));
+        PutShape(shape, m.summary.quantile.size());
+        for (const auto& q : m.summary.quantile) {
+          PutShape(shape, Bits(q.quantile));
+          put(Bits(q.value));
+        }
+        break;
+      case MetricType::Histogram:
+        put(m.histogram.sample_count);
+        put(Bits(m.histogram.sample_sum));
+        PutShape(shape, m.histogram.bucket.size());
+        for (const auto& b : m.histogram.bucket) {
+          PutShape(shape, Bits(b.upper_bound));
+          put(b.cumulative_count);
+        }
+        break;
+    }
+  }
+}
+
+const char* TypeName(MetricType t) {
+  switch (t) {
+    case MetricType::Counter: return "counter";
+    case MetricType::Gauge: return "gauge";
+    case MetricType::Summary: return "summary";
+    case MetricType::Histogram: return "histogram";
+    case MetricType::Info: return "gauge"; // no info type in the text format
+    case MetricType::Untyped: break;
+  }
+  return "untyped";
+}
+
+// Protobuf wire format (metrics.proto field numbers).
+enum WireType : std::uint8_t { kVarint = 0, kFixed64 = 1, kLen = 2 };
+
+void PutVarint(std::string& s, std::uint64_t v) {
+  while (v >= 0x80) {
+    s += static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  s += static_cast<char>(v);
+}
+
+void PutTag(std::string& s, std::uint32_t field, WireType t) { PutVarint(s, (field << 3) | t); }
+
+void PutDouble(std::string& s, std::uint32_t field, double d) {
+  PutTag(s, field, kFixed64);
+  const auto w = Bits(d);
+  for (int i = 0; i < 8; ++i) s += static_cast<char>(w >> (8 * i));
+}
+
+void PutUint(std::string& s, std::uint32_t field, std::uint64_t v) {
+  PutTag(s, field, kVarint);
+  PutVarint(s, v);
+}
+
+std::uint64_t ZigZag(std::int64_t v) { return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63); }
+
+void PutBytes(std::string& s, std::uint32_t field, std::string_view v) {
+  PutTag(s, field, kLen);
+  PutVarint(s, v.size());
+  s.append(v);
+}
+
+// Appends msg as field of s and clears it for the next message.
+void PutMessage(std::string& s, std::uint32_t field, std::string& msg) {
+  PutBytes(s, field, msg);
+  msg.clear();
+}
+
+// BucketSpan and delta fields of one side of a native histogram from its
+// (index, count) buckets in ascending index order; empty buckets are skipped.
+void PutNativeSide(std::string& s, std::uint32_t span_field, std::uint32_t delta_field,
+                   const std::vector<std::pair<int, std::uint64_t>>& buckets, std::string& scratch) {
+  std::string deltas;
+  int next = 0;
+  bool first = true;
+  std::uint32_t length = 0;
+  std::int64_t prev = 0;
+  auto flushSpan = [&](int offset) {
+    PutTag(scratch, 1, kVarint);
+    PutVarint(scratch, ZigZag(offset));
+    PutUint(scratch, 2, length);
+    PutMessage(s, span_field, scratch);
+  };
+  int offset = 0;
+  for (const auto& [index, count] : buckets) {
+    if (count == 0) continue;
+    if (first || index != next) {
+      if (!first) flushSpan(offset);
+      offset = first ? index : index - next;
+      length = 0;
+      first = false;
+    }
+    ++length;
+    next = index + 1;
+    PutVarint(deltas, ZigZag(static_cast<std::int64_t>(count) - prev));
+    prev = static_cast<std::int64_t>(count);
+  }
+  if (first) return;
+  flushSpan(offset);
+  PutBytes(s, delta_field, deltas); // packed
+}
+
+// Histogram message of a native series rendered as classic buckets (see
+// AppendNativeFamiliesLocked): undoes the cumulation and maps bounds back to
+// native indexes.
+void PutNative(std::string& s, const prometheus::ClientMetric::Histogram& h, const NativeSchema& ns,
+               std::string& scratch) {
+  std::vector<std::pair<int, std::uint64_t>> pos, neg;
+  std::uint64_t zero = 0, prev = 0;
+  for (const auto& b : h.bucket) {
+    if (std::isinf(b.upper_bound)) break;
+    const auto c = b.cumulative_count - prev;
+    prev = b.cumulative_count;
+    if (b.upper_bound < 0) neg.emplace_back(NativeIndexOfBound(-b.upper_bound, ns.schema) + 1, c);
+    else if (b.upper_bound <= ns.zero_threshold) zero += c;
+    else pos.emplace_back(NativeIndexOfBound(b.upper_bound, ns.schema), c);
+  }
+  std::reverse(neg.begin(), neg.end());
+  PutUint(s, 1, h.sample_count);
+  PutDouble(s, 2, h.sample_sum);
+  PutTag(s, 5, kVarint);
+  PutVarint(s, ZigZag(ns.schema));
+  PutDouble(s, 6, ns.zero_threshold);
+  PutUint(s, 7, zero);
+  PutNativeSide(s, 9, 10, neg, scratch);
+  PutNativeSide(s, 12, 13, pos, scratch);
+  if (std::none_of(pos.begin(), pos.end(), [](const auto& b) { return b.second != 0; }) &&
+      std::none_of(neg.begin(), neg.end(), [](const auto& b) { return b.second != 0; })) {
+    // no buckets yet: an empty span still marks the histogram as native
+    PutTag(scratch, 1, kVarint);
+    PutVarint(scratch, 0);
+    PutUint(scratch, 2, 0);
+    PutMessage(s, 12, scratch);
+  }
+}
+
+// io.prometheus.client.MetricType
+std::uint64_t ProtoType(MetricType t) {
+  switch (t) {
+    case MetricType::Counter: return 0;
+    case MetricType::Gauge: return 1;
+    case MetricType::Summary: return 2;
+    case MetricType::Histogram: return 4;
+    case MetricType::Info: return 1;
+    case MetricType::Untyped: break;
+  }
+  return 3;
+}
+
+} // namespace
+
+void RenderProtobuf(const std::vector<prometheus::MetricFamily>& fams, std::string& out,
+                    const NativeSchemas* natives) {
+  std::string fam, metric, value, item; // scratch, innermost last
+  for (const auto& f : fams) {
+    const NativeSchema* native = nullptr;
+    if (natives && f.type == MetricType::Histogram) {
+      if (auto it = natives->find(f.name); it != natives->end()) native = &it->second;
+    }
+    if (f.type == MetricType::Info) PutBytes(fam, 1, f.name + "_info");
+    else PutBytes(fam, 1, f.name);
+    if (!f.help.empty()) PutBytes(fam, 2, f.help);
+    PutUint(fam, 3, ProtoType(f.type));
+    for (const auto& m : f.metric) {
+      for (const auto& l : m.label) {
+        PutBytes(item, 1, l.name);
+        PutBytes(item, 2, l.value);
+        PutMessage(metric, 1, item);
+      }
+      switch (f.type) {
+        case MetricType::Counter:
+          PutDouble(value, 1, m.counter.value);
+          PutMessage(metric, 3, value);
+          break;
+        case MetricType::Gauge:
+          PutDouble(value, 1, m.gauge.value);
+          PutMessage(metric, 2, value);
+          break;
+        case MetricType::Info:
+          PutDouble(value, 1, m.info.value);
+          PutMessage(metric, 2, value);
+          break;
+        case MetricType::Untyped:
+          PutDouble(value, 1, m.untyped.value);
+          PutMessage(metric, 5, value);
+          break;
+        case MetricType::Summary:
+          PutUint(value, 1, m.summary.sample_count);
+          PutDouble(value, 2, m.summary.sample_sum);
+          for (const auto& q : m.summary.quantile) {
+            PutDouble(item, 1, q.quantile);
+            PutDouble(item, 2, q.value);
+            PutMessage(value, 3, item);
+          }
+          PutMessage(metric, 4, value);
+          break;
+        case MetricType::Histogram:
+          if (native) {
+            PutNative(value, m.histogram, *native, item);
+            PutMessage(metric, 7, value);
+            break;
+          }
+          PutUint(value, 1, m.histogram.sample_count);
+          PutDouble(value, 2, m.histogram.sample_sum);
+          for (const auto& b : m.histogram.bucket) {
+            PutUint(item, 1, b.cumulative_count);
+            PutDouble(item, 2, b.upper_bound);
+            PutMessage(value, 3, item);
+          }
+          PutMessage(metric, 7, value);
+          break;
+      }
+      if (m.timestamp_ms != 0) PutUint(metric, 6, static_cast<std::uint64_t>(m.timestamp_ms));
+      PutMessage(fam, 4, metric);
+    }
+    PutVarint(out, fam.size());
+    out += fam;
+    fam.clear();
+  }
+}
+
+void ExpositionCache::Build(Family& c, const prometheus::MetricFamily& f) {
+  c.help = f.help;
+  c.shape = shape_;
+  c.header.clear();
+  if (!f.help.empty()) {
+    c.header += "# HELP ";
+    c.header += f.name;
+    c.header += ' ';
+    AppendEscaped(c.header, f.help, false);
+    c.header += '\n';
+  }
+  c.header += "# TYPE ";
+  c.header += f.name;
+  c.header += ' ';
+  c.header += TypeName(f.type);
+  c.header += '\n';
+
+  c.prefixes.clear();
+  c.ends.clear();
+  c.kinds.clear();
+  c.text.clear();
+  c.values.clear();
+  for (const auto& m : f.metric) {
+    const std::uint8_t stamp = m.timestamp_ms != 0 ? kStamped : 0;
+    auto line = [&](std::uint8_t kind) {
+      c.ends.push_back(static_cast<std::uint32_t>(c.prefixes.size()));
+      c.kinds.push_back(kind | stamp);
+    };
+    switch (f.type) {
+      case MetricType::Summary:
+        AppendLine(c.prefixes, f.name, "_count", m);
+        line(kCount);
+        AppendLine(c.prefixes, f.name, "_sum", m);
+        line(kDouble);
+        for (const auto& q : m.summary.quantile) {
+          AppendLine(c.prefixes, f.name, {}, m, "quantile", q.quantile);
+          line(kDouble);
+        }
+        break;
+      case MetricType::Histogram:
+        AppendLine(c.prefixes, f.name, "_count", m);
+        line(kCount);
+        AppendLine(c.prefixes, f.name, "_sum", m);
+        line(kDouble);
+        for (const auto& b : m.histogram.bucket) {
+          AppendLine(c.prefixes, f.name, "_bucket", m, "le", b.upper_bound);
+          line(kCount);
+        }
+        break;
+      default:
+        AppendLine(c.prefixes, f.name, f.type == MetricType::Info ? "_info" : "", m);
+        line(kDouble);
+        break;
+    }
+  }
+}
+
+void ExpositionCache::Render(const std::vector<prometheus::MetricFamily>& fams, std::string& out) {
+  ++pass_;
+  for (const auto& f : fams) {
+    key_.assign(1, static_cast<char>(f.type));
+    key_ += f.name;
+    auto& c = fams_[key_];
+    c.pass = pass_;
+    Scan(f, shape_, values_);
+    if (c.shape != shape_ || c.help != f.help || c.header.empty()) Build(c, f);
+    if (c.values == values_ && !c.text.empty()) { // nothing moved since the last render
+      out += c.text;
+      continue;
+    }
+    c.values.swap(values_);
+    c.text = c.header;
+    std::size_t v = 0;
+    std::uint32_t begin = 0;
+    for (std::size_t i = 0; i < c.ends.size(); ++i) {
+      c.text.append(c.prefixes, begin, c.ends[i] - begin);
+      begin = c.ends[i];
+      const auto w = c.values[v++];
+      if (c.kinds[i] & kCount) AppendInt(c.text, w);
+      else AppendDouble(c.text, std::bit_cast<double>(w));
+      if (c.kinds[i] & kStamped) {
+        c.text += ' ';
+        AppendInt(c.text, static_cast<std::int64_t>(c.values[v++]));
+      }
+      c.text += '\n';
+    }
+    out += c.text;
+  }
+  if (fams_.size() > fams.size()) std::erase_if(fams_, [&](const auto& kv) { return kv.second.pass != pass_; });
+}
+
+} // namespace promkit
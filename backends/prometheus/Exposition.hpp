@@ -0,0 +1,65 @@
+// Text exposition rendered from per-series templates, and the protobuf one
+#pragma once
+
+#include <prometheus/metric_family.h>
+
+#include "NativeHistogram.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace promkit {
+
+// Renders families in the Prometheus text format (0.0.4). The static part of
+// each line (name and labels, le/quantile included) is rendered once into a
+// per-family template; a render only formats the values into it, and a family
+// whose values all equal those of its last render is copied from that render.
+// That is a word-by-word comparison of the collected values, not dirty
+// tracking: nothing is marked when a value is recorded.
+// A template is rebuilt when the family's help, series, labels or bounds
+// change, and dropped once the family stops appearing. Templates save the
+// formatting only: every render still takes a full Collect from the caller and
+// scans each family's labels and bounds (copying them into a shape string) to
+// tell whether its template still fits. Not thread-safe.
+class ExpositionCache {
+ public:
+  void Render(const std::vector<prometheus::MetricFamily>& fams, std::string& out);
+
+ private:
+  struct Family {
+    std::string help;
+    std::string shape;                 // labels and bounds of every series, as last seen
+    std::string header;                // # HELP / # TYPE lines
+    std::string prefixes;              // "name{labels} " of every line, back to back
+    std::vector<std::uint32_t> ends;   // end of each line's prefix in prefixes
+    std::vector<std::uint8_t> kinds;   // per line: value kind, timestamp flag
+    std::vector<std::uint64_t> values; // raw value (and timestamp) words last rendered
+    std::string text;                  // last render
+    std::uint64_t pass = 0;            // last Render that used it
+  };
+
+  void Build(Family& c, const prometheus::MetricFamily& f);
+
+  std::unordered_map<std::string, Family> fams_; // key: type byte + name
+  std::string key_;
+  std::string shape_;
+  std::vector<std::uint64_t> values_;
+  std::uint64_t pass_ = 0;
+};
+
+// Content-Type of the length-delimited io.prometheus.client.MetricFamily stream.
+inline constexpr const char* kProtobufContentType =
+    "application/vnd.google.protobuf; proto=io.prometheus.client.MetricFamily; encoding=delimited";
+
+// Appends fams as varint-delimited io.prometheus.client.MetricFamily messages,
+// encoded by hand: values are written as raw fixed64 words, so nothing is
+// formatted. Info families become gauges named <name>_info, as in the text form.
+// Histogram families listed in natives carry native buckets at those bounds
+// (see NativeUpperBound) and are encoded as native histograms (schema, zero
+// bucket, spans and deltas) instead of classic buckets.
+void RenderProtobuf(const std::vector<prometheus::MetricFamily>& fams, std::string& out,
+                    const NativeSchemas* natives = nullptr);
+
+} // namespace promkit
@@ -0,0 +1,252 @@
+#include "MetricsServer.hpp"
+#include "Exposition.hpp"
+
+#include <CivetServer.h>
+#include <civetweb.h>
+
+#include <algorithm>
+#include <charconv>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef PROMKIT_HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
+namespace {
+
+constexpr const char* kThreads = "4";
+constexpr const char* kRequestTimeoutMs = "10000";  // to read a request, or to send a response
+constexpr const char* kKeepAliveTimeoutMs = "5000"; // idle wait for the next request
+constexpr std::size_t kMinGzip = 1024; // smaller bodies are sent as is
+constexpr std::size_t kGzipChunk = 32 * 1024; // compressed bytes per chunk
+
+#ifdef PROMKIT_HAVE_ZLIB
+// Deflates a body into gzip chunks of the chunked transfer encoding, one
+// chunk per Next, holding only zlib's window and one chunk of output.
+class GzipChunker {
+ public:
+  GzipChunker(std::shared_ptr<const std::string> body, int level) : body_(std::move(body)) {
+    ok_ = ::deflateInit2(&zs_, level, Z_DEFLATED, 15 + 16 /* gzip wrapper */, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+  }
+  ~GzipChunker() {
+    if (ok_) ::deflateEnd(&zs_);
+  }
+  GzipChunker(const GzipChunker&) = delete;
+  GzipChunker& operator=(const GzipChunker&) = delete;
+
+  bool ok() const { return ok_; }
+  bool done() const { return done_; }
+
+  // Appends the next chunk to out, the terminating empty chunk after the last
+  // one. Returns false once everything was appended, or on a zlib error.
+  bool Next(std::string& out) {
+    if (!ok_ || done_) return false;
+    buf_.resize(kGzipChunk);
+    zs_.next_out = reinterpret_cast<Bytef*>(buf_.data());
+    zs_.avail_out = static_cast<uInt>(buf_.size());
+    int rc = Z_OK;
+    while (zs_.avail_out > 0 && rc == Z_OK) {
+      if (zs_.avail_in == 0 && fed_ < body_->size()) {
+        const auto n = std::min<std::size_t>(body_->size() - fed_, 1u << 20);
+        zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body_->data() + fed_));
+        zs_.avail_in = static_cast<uInt>(n);
+        fed_ += n;
+      }
+      rc = ::deflate(&zs_, fed_ == body_->size() && zs_.avail_in == 0 ? Z_FINISH : Z_NO_FLUSH);
+    }
+    if (rc != Z_OK && rc != Z_STREAM_END) {
+      ok_ = false;
+      ::deflateEnd(&zs_);
+      return false;
+    }
+    const auto n = buf_.size() - zs_.avail_out;
+    if (n > 0) {
+      char hex[16];
+      const auto r = std::to_chars(hex, hex + sizeof(hex), n, 16);
+      out.append(hex, r.ptr);
+      out += "\r\n";
+      out.append(buf_.data(), n);
+      out += "\r\n";
+    }
+    if (rc == Z_STREAM_END) {
+      out += "0\r\n\r\n";
+      done_ = true;
+    }
+    return true;
+  }
+
+ private:
+  std::shared_ptr<const std::string> body_;
+  z_stream zs_{};
+  std::string buf_;
+  std::size_t fed_ = 0; // body bytes handed to zlib
+  bool ok_ = false;
+  bool done_ = false;
+};
+#else
+class GzipChunker {
+ public:
+  GzipChunker(std::shared_ptr<const std::string>, int) {}
+  bool ok() const { return false; }
+  bool done() const { return false; }
+  bool Next(std::string&) { return false; }
+};
+#endif
+
+bool IEquals(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+    return (x | 0x20) == (y | 0x20);
+  });
+}
+
+std::string_view Trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+  return s;
+}
+
+// Weight (its q parameter, 1 when absent) of the first item of a header value
+// that match(token, params) accepts, or -1 when there is none. Items are
+// comma-separated, parameters follow the token after ';'.
+template <typename Match>
+double HeaderWeight(const char* header, Match&& match) {
+  std::string_view value = header ? header : "";
+  while (!value.empty()) {
+    const auto comma = value.find(',');
+    auto item = value.substr(0, comma);
+    value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+    const auto semi = item.find(';');
+    const auto params = semi == std::string_view::npos ? std::string_view{} : item.substr(semi + 1);
+    if (!match(Trim(item.substr(0, semi)), params)) continue;
+    double q = 1;
+    for (auto rest = params; !rest.empty();) {
+      const auto end = rest.find(';');
+      const auto p = Trim(rest.substr(0, end));
+      rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+      if (p.size() < 2 || (p[0] | 0x20) != 'q' || p[1] != '=') continue;
+      if (std::from_chars(p.data() + 2, p.data() + p.size(), q).ec != std::errc{}) q = 0;
+    }
+    return q;
+  }
+  return -1;
+}
+
+// Whether a header value lists `token` (case-insensitive) with a weight above
+// zero: "gzip;q=0" does not count.
+bool HeaderHas(const char* header, std::string_view token) {
+  return HeaderWeight(header, [&](std::string_view t, std::string_view) { return IEquals(t, token); }) > 0;
+}
+
+// Protobuf when the Accept header weighs the delimited MetricFamily stream at
+// least as high as plain text; text otherwise (and without an Accept header).
+promkit::MetricsServer::Format Negotiate(const char* accept) {
+  const double proto = HeaderWeight(accept, [](std::string_view t, std::string_view params) {
+    return IEquals(t, "application/vnd.google.protobuf") && params.find("encoding=delimited") != std::string_view::npos &&
+           params.find("io.prometheus.client.MetricFamily") != std::string_view::npos;
+  });
+  const double text = HeaderWeight(accept, [](std::string_view t, std::string_view) {
+    return IEquals(t, "text/plain") || t == "*/*";
+  });
+  return proto > 0 && proto >= text ? promkit::MetricsServer::Format::kProtobuf : promkit::MetricsServer::Format::kText;
+}
+
+constexpr const char* kTextContentType = "text/plain; version=0.0.4; charset=utf-8";
+
+// civetweb's listening_ports entry for host:port; an IPv6 host is bracketed.
+std::string ListenSpec(const std::string& host, int port) {
+  const auto p = std::to_string(port);
+  if (host.empty()) return p;
+  if (host.find(':') != std::string::npos && host.front() != '[') return "[" + host + "]:" + p;
+  return host + ":" + p;
+}
+
+} // namespace
+
+namespace promkit {
+
+class MetricsServer::ScrapeHandler : public CivetHandler {
+ public:
+  ScrapeHandler(std::string path, Handler handler, int gzip_level)
+      : path_(std::move(path)), handler_(std::move(handler)), gzip_level_(gzip_level) {}
+
+  bool handleGet(CivetServer*, mg_connection* conn) override { return Serve(conn, false); }
+  bool handleHead(CivetServer*, mg_connection* conn) override { return Serve(conn, true); }
+
+ private:
+  bool Serve(mg_connection* conn, bool head) {
+    const mg_request_info* info = mg_get_request_info(conn);
+    // civetweb also routes subpaths (path/...) here: those are not ours
+    if (!info || !info->local_uri || path_ != info->local_uri) return false;
+    const auto format = Negotiate(mg_get_header(conn, "Accept"));
+    std::shared_ptr<const std::string> body;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      try {
+        body = handler_(format);
+      } catch (...) {}
+    }
+    if (!body) {
+      mg_printf(conn, "HTTP/1.1 500 Internal Server Error\r\nContent-Type: %s\r\nContent-Length: 0\r\n\r\n",
+                kTextContentType);
+      return true;
+    }
+    const char* type = format == Format::kProtobuf ? kProtobufContentType : kTextContentType;
+    std::unique_ptr<GzipChunker> gzip;
+    if (gzip_level_ > 0 && !head && body->size() >= kMinGzip && info->http_version &&
+        std::string_view(info->http_version) == "1.1" && HeaderHas(mg_get_header(conn, "Accept-Encoding"), "gzip")) {
+      gzip = std::make_unique<GzipChunker>(body, gzip_level_);
+      if (!gzip->ok()) gzip.reset();
+    }
+    if (!gzip) {
+      mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nVary: Accept, Accept-Encoding\r\nContent-Length: %zu\r\n\r\n",
+                type, body->size());
+      if (!head) mg_write(conn, body->data(), body->size());
+      return true;
+    }
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nVary: Accept, Accept-Encoding\r\n"
+              "Content-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n",
+              type);
+    // zlib does not fail on a stream it initialized; if it did, the response
+    // would end unterminated and the scraper would discard it
+    std::string chunk;
+    while (gzip->Next(chunk)) {
+      if (mg_write(conn, chunk.data(), chunk.size()) <= 0) break; // scraper went away
+      chunk.clear();
+    }
+    return true;
+  }
+
+  std::string path_;
+  Handler handler_;
+  int gzip_level_; // 0: never compress
+  std::mutex mu_;  // one handler call at a time
+};
+
+MetricsServer::MetricsServer(const std::string& host, int port, std::string path, Handler handler, int gzip_level)
+    : scrape_(std::make_unique<ScrapeHandler>(path, std::move(handler), std::clamp(gzip_level, 0, 9))) {
+  const std::vector<std::string> options = {
+      "listening_ports", ListenSpec(host, port),
+      "num_threads", kThreads,
+      "request_timeout_ms", kRequestTimeoutMs,
+      "enable_keep_alive", "yes",
+      "keep_alive_timeout_ms", kKeepAliveTimeoutMs,
+  };
+  // CivetServer throws CivetException (a std::runtime_error) when it cannot bind
+  server_ = std::make_unique<CivetServer>(options);
+  server_->addHandler(path, scrape_.get());
+  const auto ports = server_->getListeningPorts();
+  if (ports.empty()) throw std::runtime_error("cannot bind " + ListenSpec(host, port));
+  port_ = ports.front();
+}
+
+MetricsServer::~MetricsServer() {
+  if (server_) server_->close(); // joins civetweb's threads before scrape_ goes
+}
+
+} // namespace promkit
@@ -0,0 +1,45 @@
+// HTTP endpoint for /metrics, served by civetweb
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+class CivetServer;
+
+namespace promkit {
+
+// Serves GET/HEAD of one path from a civetweb server (the copy vendored by
+// prometheus-cpp's pull module). Connection handling, keep-alive and request
+// timeouts are civetweb's; the handler registered on the path only negotiates
+// the response and writes it. Scrape bodies are produced by the caller's
+// handler, one call at a time, and may be the same body for several scrapes.
+// The body format is negotiated from the Accept header (text, or the protobuf
+// delimited stream) and passed to the handler.
+//
+// When built with zlib and gzip_level > 0, HTTP/1.1 scrapes that accept gzip
+// get the body deflated as it is sent, one chunk (chunked transfer encoding)
+// at a time, so no compressed copy of the whole body is ever held.
+class MetricsServer {
+ public:
+  enum class Format { kText, kProtobuf };
+  using Handler = std::function<std::shared_ptr<const std::string>(Format)>;
+
+  // Binds host:port (port 0 picks an ephemeral one) and starts serving.
+  // Throws std::runtime_error when the address cannot be bound.
+  MetricsServer(const std::string& host, int port, std::string path, Handler handler, int gzip_level = 0);
+  ~MetricsServer();
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+  int port() const { return port_; }
+
+ private:
+  class ScrapeHandler;
+
+  std::unique_ptr<ScrapeHandler> scrape_; // outlives server_, which calls it
+  std::unique_ptr<CivetServer> server_;
+  int port_ = 0;
+};
+
+} // namespace promkit
@@ -2,24 +2,39 @@
 
 #include <promkit/promkit.hpp>
 #include "core/Config.hpp"
+#include "core/FreshCache.hpp"
+#include "core/LocalCounters.hpp"
+#include "core/NativeHistogram.hpp"
+#include "core/QuantileSketch.hpp"
+#include "core/SeriesIndex.hpp"
+#include "core/Shard.hpp"
+#include "core/TickClock.hpp"
 
 #ifdef PROMKIT_BACKEND_PROM
 
-#include <prometheus/exposer.h>
 #include <prometheus/registry.h>
 #include <prometheus/counter.h>
 #include <prometheus/gauge.h>
 #include <prometheus/histogram.h>
 #include "mux/MuxCollector.hpp"
+#include "mux/ShmSegment.hpp"
+#include "Exposition.hpp"
+#include "MetricsServer.hpp"
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #ifdef _WIN32
 #include <process.h>
@@ -36,38 +51,149 @@ static int GetPid() {
 #ifdef _WIN32
   return _getpid();
 #else
-  return GetPid();
+  return static_cast<int>(::getpid());
 #endif
 }
 
+// Series behind a CounterId. The value is promkit-owned: one atomic in atomic
+// mode, or a column of the metric's ShardedCounters/LocalCounters block in
+// sharded/local mode. It is folded into the prometheus counter (the exposition
+// sink) when the registry is collected.
+struct CounterSeries {
+  prometheus::Counter* sink = nullptr;
+  ShardedCounters* shards = nullptr; // sharded mode
+  LocalCounters* local = nullptr;    // local mode
+  std::uint32_t col = 0;             // column in shards
+  std::atomic<double> value{0.0};    // atomic mode
+  double folded = 0.0;               // part of the value already pushed into sink (under mu)
+};
+
+// Series behind a GaugeId; the sink is Set from value on collect.
+struct GaugeSeries {
+  prometheus::Gauge* sink = nullptr;
+  std::atomic<double> value{0.0};
+};
+
+// Series behind a HistogramId. Atomic mode observes the sink directly; sharded
+// observations land in a column of the metric's ShardedHistograms block and are
+// merged into the sink with ObserveMultiple at collect time. Native series have
+// no sink: they are collected from their NativeHistogram.
+struct HistogramSeries {
+  NativeHistogram* native = nullptr;
+  prometheus::Histogram* sink = nullptr;
+  ShardedHistograms* shards = nullptr;
+  std::uint32_t col = 0;
+  std::vector<std::uint64_t> folded; // per-bucket counts already pushed into sink (under mu)
+  double folded_sum = 0.0;
+};
+
 struct MetricSpec {
-  std::string type; // counter|gauge|histogram
+  std::string type; // counter|gauge|histogram|summary
   std::map<std::string, std::string> const_labels; // always injected for this metric
   std::map<std::string, std::vector<std::string>> dyn; // allowed dynamic labels and values
   std::vector<double> buckets; // for histograms when provided
   bool has_buckets = false;
   std::string help;
+  std::string counter_mode; // atomic|sharded|local
+  std::string histogram_mode; // atomic|sharded
+
+  // Dense series table: one series per combination of dynamic label values,
+  // in mixed-radix order of dyn_keys (sorted; keys with an empty value list
+  // add no dimension), so a combination's slot is computed arithmetically.
+  std::vector<std::string> dyn_keys;
+  std::vector<const std::vector<std::string>*> dyn_values; // parallel to dyn_keys, points into dyn
+  std::vector<std::uint32_t> radix;
+  // Parallel to dyn_keys: a global/const label of the same key wins, so the
+  // key's value does not tell series apart. Its digit resolves as 0, and only
+  // slots with those digits at 0 (see CanonicalSlot) carry a series.
+  std::vector<bool> pinned;
+  std::size_t series_count = 0;
+  std::unique_ptr<CounterSeries[]> counters; // the one matching type is set
+  std::unique_ptr<GaugeSeries[]> gauges;
+  std::unique_ptr<HistogramSeries[]> histograms;
+  std::vector<QuantileSketch*> summaries; // owned by the metric's SketchFamily
+};
+
+// A native histogram metric: owned here since prometheus-cpp has no such type.
+struct NativeFamily {
+  std::string help;
+  NativeSchema schema;
+  std::vector<std::vector<prometheus::ClientMetric::Label>> labels; // per series
+  std::vector<std::unique_ptr<NativeHistogram>> series;
+};
+
+// A summary metric: sketches owned here, exposed as a summary (or, in mux
+// mode, in sketch form for the aggregator to merge; see AppendSketchFamiliesLocked).
+struct SketchFamily {
+  std::string help;
+  std::vector<double> quantiles;
+  int schema = 0;
+  std::string marker; // value of the sketch form's kSketchLabel
+  double max_age_seconds = 60;
+  int age_buckets = 5;
+  std::vector<std::vector<prometheus::ClientMetric::Label>> labels; // per series
+  std::vector<std::unique_ptr<QuantileSketch>> series;
+};
+
+// Why a Create* for a metric defined in [[metrics]] returned 0.
+enum class Reject : std::uint8_t { Labels, MissingLabel, Type };
+inline constexpr int kRejectReasons = 3;
+
+// Collectable exposed in place of the raw registry: folds promkit-owned values
+// into their sinks, then collects the registry.
+class FoldingCollectable : public prometheus::Collectable {
+ public:
+  explicit FoldingCollectable(std::shared_ptr<prometheus::Registry> registry) : registry_(std::move(registry)) {}
+  std::vector<prometheus::MetricFamily> Collect() const override;
+
+ private:
+  std::shared_ptr<prometheus::Registry> registry_;
 };
 
 struct Backend {
-  std::unique_ptr<prometheus::Exposer> exposer;
+  std::unique_ptr<MetricsServer> server;
   std::shared_ptr<prometheus::Registry> registry;
+  std::shared_ptr<FoldingCollectable> collectable; // what the server/mux actually collect
 
   // Families by full metric name
   std::mutex mu;
   std::map<std::string, prometheus::Family<prometheus::Counter>*> counters;
   std::map<std::string, prometheus::Family<prometheus::Gauge>*> gauges;
   std::map<std::string, prometheus::Family<prometheus::Histogram>*> histograms;
+  std::map<std::string, NativeFamily> natives;
+  std::shared_ptr<const NativeSchemas> native_schemas; // what the protobuf exposition encodes natively
+  std::map<std::string, SketchFamily> sketches;
 
-  // Pre-registered time series caches by key: name|k=v,k2=v2 (sorted by key)
-  std::map<std::string, prometheus::Counter*> counter_series;
-  std::map<std::string, prometheus::Gauge*> gauge_series;
-  std::map<std::string, prometheus::Histogram*> hist_series;
+  // exporter.self_metrics (null when off): rejects are CounterSeries in
+  // counter_store, folded like any counter; scrape timings go straight to
+  // their histograms, one per exposition format (text, protobuf).
+  CounterSeries* rejected[kRejectReasons] = {};
+  prometheus::Histogram* scrape_seconds[2] = {};
+
+  // Ad-hoc (not defined in TOML) series ids by key: name|k=v,k2=v2 (sorted by key).
+  // Lookups are lock-free; inserts happen under mu. Values are CounterSeries*/
+  // GaugeSeries*/HistogramSeries*/QuantileSketch*. TOML-defined metrics use MetricSpec's dense table.
+  SeriesIndex counter_index;
+  SeriesIndex gauge_index;
+  SeriesIndex hist_index;
+  SeriesIndex summary_index;
+  // Lock-free readers of the indexes/specs; Shutdown waits them out before clearing.
+  ReaderGate readers;
+
+  // Ad-hoc series storage (stable addresses; ids point into it) and the
+  // per-thread blocks behind sharded series (TOML metrics get one per metric).
+  std::deque<CounterSeries> counter_store;
+  std::deque<GaugeSeries> gauge_store;
+  std::deque<HistogramSeries> hist_store;
+  std::vector<std::unique_ptr<ShardedCounters>> counter_blocks;
+  std::vector<std::unique_ptr<LocalCounters>> local_blocks;
+  std::vector<std::unique_ptr<ShardedHistograms>> hist_blocks;
 
   // Config & metric specs (from TOML)
   FileConfig fcfg;
   bool has_fcfg = false;
   std::map<std::string, MetricSpec> specs; // key: full metric name
+  SeriesIndex spec_index;                  // full metric name -> const MetricSpec*
 
   // Global config
   Config cfg;
@@ -81,6 +207,10 @@ struct Backend {
   std::string mux_dir;           // directory for worker descriptors
   std::string mux_worker_file;   // path to my descriptor file when worker
   std::shared_ptr<promkit::mux::MuxCollector> mux_collectable; // keep alive
+  // shm transport (worker side): segment and the thread republishing it
+  std::unique_ptr<promkit::mux::ShmWriter> shm_writer;
+  std::thread shm_publisher;
+  std::atomic<bool> shm_stop{false};
 };
 
 Backend& G() {
@@ -100,32 +230,102 @@ static std::string FullName(const std::string& prefix, const std::string& name)
   return prefix + "_" + name;
 }
 
-static std::string LabelsKey(const std::map<std::string, std::string>& labels) {
-  std::vector<std::pair<std::string,std::string>> v(labels.begin(), labels.end());
-  std::sort(v.begin(), v.end(), [](auto& a, auto& b){ return a.first < b.first; });
-  std::string key;
-  for (size_t i = 0; i < v.size(); ++i) {
-    if (i) key.push_back(',');
-    key.append(v[i].first);
-    key.push_back('=');
-    key.append(v[i].second);
+using Labels = std::map<std::string, std::string>;
+
+// Streams the pieces of FullName(prefix, name).
+template <typename Fn>
+static void ForEachNamePiece(const std::string& name, Fn&& fn) {
+  if (!G().cfg.prefix.empty()) {
+    fn(std::string_view(G().cfg.prefix));
+    fn(std::string_view("_"));
   }
-  return key;
+  fn(std::string_view(name));
 }
 
+// Streams the series key "<full name>|k=v,k2=v2" of an ad-hoc series (labels
+// sorted by key, global labels winning over provided ones) without building it.
+template <typename Fn>
+static void ForEachKeyPiece(const std::string& name, const Labels& provided, Fn&& fn) {
+  auto a = G().cfg.labels.begin(), ae = G().cfg.labels.end();
+  auto b = provided.begin(), be = provided.end();
+  ForEachNamePiece(name, fn);
+  fn(std::string_view("|"));
+  bool first = true;
+  while (a != ae || b != be) {
+    // smallest head key of the two sorted maps
+    const std::string* k = nullptr;
+    const std::string* v = nullptr;
+    if (b == be || (a != ae && !(b->first < a->first))) {
+      k = &a->first;
+      v = &a->second;
+      if (b != be && b->first == a->first) ++b;
+      ++a;
+    } else {
+      k = &b->first;
+      v = &b->second;
+      ++b;
+    }
+    if (!first) fn(std::string_view(","));
+    first = false;
+    fn(std::string_view(*k));
+    fn(std::string_view("="));
+    fn(std::string_view(*v));
+  }
+}
+
+// Looks up the key produced by stream(fn) in index: hashes the pieces, then
+// confirms a hash hit piecewise against the stored key. No allocation.
+template <typename Stream>
+static std::uint64_t FindStreamed(const SeriesIndex& index, Stream&& stream) {
+  std::uint64_t h = kHashSeed;
+  stream([&](std::string_view piece) { h = HashBytes(h, piece); });
+  return index.Find(h, [&](std::string_view key) {
+    std::size_t off = 0;
+    bool ok = true;
+    stream([&](std::string_view piece) {
+      if (ok && key.substr(off, piece.size()) == piece) off += piece.size();
+      else ok = false;
+    });
+    return ok && off == key.size();
+  });
+}
+
+static const MetricSpec* FindSpec(const std::string& name) {
+  return reinterpret_cast<const MetricSpec*>(
+      FindStreamed(G().spec_index, [&](auto&& fn) { ForEachNamePiece(name, fn); }));
+}
+
+struct ReadScope {
+  ReadScope() noexcept { G().readers.Enter(); }
+  ~ReadScope() { G().readers.Leave(); }
+};
+
 static std::vector<double> DefaultLatencyBuckets() {
   return {0.001, 0.005, 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2};
 }
 
-// Clear all local caches/families/specs under lock. Does not touch registry/exposer.
+// Clear all local caches/families/specs under lock. Does not touch registry/server.
 static void ClearCachesLocked() {
   G().counters.clear();
   G().gauges.clear();
   G().histograms.clear();
-  G().counter_series.clear();
-  G().gauge_series.clear();
-  G().hist_series.clear();
+  G().natives.clear();
+  G().native_schemas.reset();
+  G().sketches.clear();
+  std::fill(std::begin(G().rejected), std::end(G().rejected), nullptr);
+  std::fill(std::begin(G().scrape_seconds), std::end(G().scrape_seconds), nullptr);
+  G().counter_index.Clear();
+  G().gauge_index.Clear();
+  G().hist_index.Clear();
+  G().summary_index.Clear();
+  G().spec_index.Clear();
   G().specs.clear();
+  G().counter_store.clear();
+  G().gauge_store.clear();
+  G().hist_store.clear();
+  G().counter_blocks.clear();
+  G().local_blocks.clear();
+  G().hist_blocks.clear();
   G().has_fcfg = false;
 }
 
@@ -151,13 +351,16 @@ static std::string MuxComponentName(const Config& cfg) {
   return std::string{"component-"} + std::to_string(GetPid());
 }
 
-static std::string WriteWorkerDescriptor(const Config& cfg, const std::string& dir, int port) {
+// shm_path non-empty: the aggregator reads that segment instead of scraping port.
+static std::string WriteWorkerDescriptor(const Config& cfg, const std::string& dir, int port,
+                                         const std::string& shm_path = {}) {
   if (!EnsureDir(dir)) return {};
   const int pid = GetPid();
   std::string file = dir + "/port." + std::to_string(pid);
   std::ofstream ofs(file, std::ios::trunc);
   if (!ofs) return {};
-  ofs << "endpoint 127.0.0.1:" << port << "\n";
+  if (shm_path.empty()) ofs << "endpoint 127.0.0.1:" << port << "\n";
+  else ofs << "shm " << shm_path << "\n";
   ofs << "component " << MuxComponentName(cfg) << "\n";
   // pid 鍐欏叆浠呯敤浜庤皟璇曪紱鍚庣画鑱氬悎涓嶅啀浣跨敤 pid 浣滀负鏍囩
   ofs << "pid " << pid << "\n";
@@ -166,6 +369,40 @@ static std::string WriteWorkerDescriptor(const Config& cfg, const std::string& d
   return file;
 }
 
+// mux worker over shared memory: no HTTP server; a publisher thread collects
+// into the segment once at start and then only when the aggregator asks, and
+// the descriptor points the aggregator at it.
+static bool StartShmWorker(const Config& cfg) {
+  const auto seg_dir = G().mux_dir + "/shm";
+  if (!EnsureDir(seg_dir)) return false;
+  auto writer = std::make_unique<promkit::mux::ShmWriter>();
+  if (!writer->Open(seg_dir + "/seg." + std::to_string(GetPid()), MuxComponentName(cfg), GetPid())) return false;
+  G().mux_worker_file = WriteWorkerDescriptor(cfg, G().mux_dir, 0, writer->path());
+  if (G().mux_worker_file.empty()) return false;
+  G().shm_writer = std::move(writer);
+  G().shm_stop.store(false, std::memory_order_relaxed);
+  G().shm_publisher = std::thread([] {
+    auto& writer = *G().shm_writer;
+    do {
+      try {
+        writer.Publish(G().collectable->Collect());
+      } catch (...) {}
+      // Interrupt wakes this for Shutdown; the timeout covers a wake that came early
+      while (!G().shm_stop.load(std::memory_order_relaxed) && !writer.WaitForRequest(std::chrono::milliseconds(200))) {}
+    } while (!G().shm_stop.load(std::memory_order_relaxed));
+  });
+  return true;
+}
+
+static void StopShmWorker() {
+  if (G().shm_publisher.joinable()) {
+    G().shm_stop.store(true, std::memory_order_relaxed);
+    G().shm_writer->Interrupt();
+    G().shm_publisher.join();
+  }
+  G().shm_writer.reset(); // unlinks the segment
+}
+
 static prometheus::Family<prometheus::Counter>& GetOrMakeCounterFam(const std::string& fname, const std::string& help) {
   auto it = G().counters.find(fname);
   if (it != G().counters.end()) return *it->second;
@@ -190,6 +427,221 @@ static prometheus::Family<prometheus::Histogram>& GetOrMakeHistFam(const std::st
   return *fam;
 }
 
+static const std::string& CounterModeFor(const MetricSpec* spec) {
+  if (spec && !spec->counter_mode.empty()) return spec->counter_mode;
+  return G().cfg.counter_mode;
+}
+
+static const std::string& HistogramModeFor(const MetricSpec* spec) {
+  if (spec && !spec->histogram_mode.empty()) return spec->histogram_mode;
+  return G().cfg.histogram_mode;
+}
+
+// Requires mu. The family of a summary, configured from def on first use.
+static SketchFamily& GetOrMakeSketchFamLocked(const std::string& fname, const std::string& help, const MetricDef& def) {
+  auto [it, inserted] = G().sketches.try_emplace(fname);
+  auto& sf = it->second;
+  if (inserted) {
+    sf.help = help;
+    sf.quantiles = def.quantiles;
+    sf.schema = SketchSchema(def.relative_accuracy);
+    sf.marker = promkit::mux::SketchMarker(sf.schema, sf.quantiles);
+    sf.max_age_seconds = def.max_age_seconds;
+    sf.age_buckets = def.age_buckets;
+  }
+  return sf;
+}
+
+static QuantileSketch* AddSketchLocked(SketchFamily& sf, const Labels& labels) {
+  std::vector<prometheus::ClientMetric::Label> ls;
+  for (const auto& [k, v] : labels) ls.push_back({k, v});
+  sf.labels.push_back(std::move(ls));
+  return sf.series.emplace_back(std::make_unique<QuantileSketch>(sf.schema, sf.max_age_seconds, sf.age_buckets)).get();
+}
+
+// Requires mu. Per-thread block for `columns` sharded series, or null in atomic mode.
+static ShardedCounters* NewCounterBlockLocked(const std::string& mode, std::size_t columns) {
+  if (mode != "sharded") return nullptr;
+  return G().counter_blocks.emplace_back(std::make_unique<ShardedCounters>(columns)).get();
+}
+
+static LocalCounters* NewLocalBlockLocked(const std::string& mode, std::size_t columns) {
+  if (mode != "local") return nullptr;
+  return G().local_blocks.emplace_back(std::make_unique<LocalCounters>(columns)).get();
+}
+
+static ShardedHistograms* NewHistBlockLocked(const std::string& mode, std::size_t columns,
+                                             const std::vector<double>& buckets) {
+  if (mode != "sharded") return nullptr;
+  return G().hist_blocks.emplace_back(std::make_unique<ShardedHistograms>(columns, buckets)).get();
+}
+
+// Requires mu. Registers promkit's own metrics (exporter.self_metrics).
+static void RegisterSelfMetricsLocked() {
+  static constexpr const char* kReasons[kRejectReasons] = {"labels", "missing_label", "type"};
+  auto& rejected = GetOrMakeCounterFam("promkit_create_rejected_total",
+                                       "Create* calls refused for a metric defined in [[metrics]], by reason");
+  for (int r = 0; r < kRejectReasons; ++r) {
+    auto& s = G().counter_store.emplace_back();
+    s.sink = &rejected.Add(MergeLabels(G().cfg.labels, {{"reason", kReasons[r]}}));
+    G().rejected[r] = &s;
+  }
+  static constexpr const char* kFormats[] = {"text", "protobuf"};
+  const std::vector<double> buckets{0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5};
+  auto& scrape = GetOrMakeHistFam("promkit_scrape_duration_seconds", "Time to collect and render a /metrics body");
+  for (int f = 0; f < 2; ++f) {
+    G().scrape_seconds[f] = &scrape.Add(MergeLabels(G().cfg.labels, {{"format", kFormats[f]}}), buckets);
+  }
+}
+
+static void CountReject(Reject r) {
+  if (auto* s = G().rejected[static_cast<int>(r)]) s->value.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void BindHistogram(HistogramSeries& s, prometheus::Histogram& sink, ShardedHistograms* block, std::size_t col) {
+  s.sink = &sink;
+  s.shards = block;
+  s.col = static_cast<std::uint32_t>(col);
+  if (block) s.folded.assign(block->BucketCount(), 0);
+}
+
+// Fold helpers (require mu): push what accumulated since the last fold into the sinks.
+static void FoldCounter(CounterSeries& s) {
+  const double v = s.local    ? s.local->Sum(s.col)
+                   : s.shards ? s.shards->Sum(s.col)
+                              : s.value.load(std::memory_order_relaxed);
+  if (v > s.folded) {
+    s.sink->Increment(v - s.folded);
+    s.folded = v;
+  }
+}
+
+static void FoldGauge(GaugeSeries& s) {
+  if (s.sink) s.sink->Set(s.value.load(std::memory_order_relaxed));
+}
+
+static void FoldHistogram(HistogramSeries& s, std::vector<std::uint64_t>& counts, std::vector<double>& increments) {
+  if (!s.shards) return;
+  double sum = 0;
+  s.shards->Snapshot(s.col, counts, sum);
+  increments.assign(counts.size(), 0.0);
+  bool changed = false;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] == s.folded[i]) continue;
+    increments[i] = static_cast<double>(counts[i] - s.folded[i]);
+    changed = true;
+  }
+  if (!changed) return;
+  s.sink->ObserveMultiple(increments, sum - s.folded_sum);
+  s.folded = counts;
+  s.folded_sum = sum;
+}
+
+static void FoldAllLocked() {
+  std::vector<std::uint64_t> counts;
+  std::vector<double> increments;
+  for (auto& [name, spec] : G().specs) {
+    for (std::size_t i = 0; i < spec.series_count; ++i) {
+      if (spec.counters) FoldCounter(spec.counters[i]);
+      else if (spec.gauges) FoldGauge(spec.gauges[i]);
+      else if (spec.histograms) FoldHistogram(spec.histograms[i], counts, increments);
+    }
+  }
+  for (auto& s : G().counter_store) FoldCounter(s);
+  for (auto& s : G().gauge_store) FoldGauge(s);
+  for (auto& s : G().hist_store) FoldHistogram(s, counts, increments);
+}
+
+// Native series as classic histograms: a bucket per non-empty native bucket
+// (negative ones, the zero bucket, positive ones) plus +Inf. The bounds are the
+// exact native ones, so workers merge by bound and the protobuf exposition
+// recovers the native buckets.
+static void AppendNativeFamiliesLocked(std::vector<prometheus::MetricFamily>& out) {
+  NativeHistogram::Snapshot snap;
+  std::vector<std::pair<double, std::uint64_t>> buckets;
+  for (const auto& [name, nf] : G().natives) {
+    auto& f = out.emplace_back();
+    f.name = name;
+    f.help = nf.help;
+    f.type = prometheus::MetricType::Histogram;
+    f.metric.resize(nf.series.size());
+    for (std::size_t i = 0; i < nf.series.size(); ++i) {
+      auto& m = f.metric[i];
+      m.label = nf.labels[i];
+      nf.series[i]->Collect(snap);
+      NativeBuckets(snap, nf.series[i]->schema(), nf.series[i]->zero_threshold(), buckets);
+      auto& h = m.histogram;
+      h.sample_count = snap.count;
+      h.sample_sum = snap.sum;
+      std::uint64_t cum = 0;
+      for (const auto& [bound, c] : buckets) h.bucket.push_back({cum += c, bound});
+      h.bucket.push_back({snap.count, std::numeric_limits<double>::infinity()});
+    }
+  }
+}
+
+// Summaries with their quantiles. In mux mode the quantiles of several workers
+// cannot be combined, so the sketch itself is sent instead, as a histogram:
+// cumulative window buckets at their native bounds, then +Inf, count and sum
+// of the whole summary (observations that left the window land in +Inf), and
+// a kSketchLabel marker with the schema and quantiles. MergeTable adds these
+// up by bound and turns them back into summaries.
+static void AppendSketchFamiliesLocked(std::vector<prometheus::MetricFamily>& out) {
+  QuantileSketch::Snapshot snap;
+  for (const auto& [name, sf] : G().sketches) {
+    auto& f = out.emplace_back();
+    f.name = name;
+    f.help = sf.help;
+    f.type = G().mux_mode ? prometheus::MetricType::Histogram : prometheus::MetricType::Summary;
+    f.metric.resize(sf.series.size());
+    for (std::size_t i = 0; i < sf.series.size(); ++i) {
+      auto& m = f.metric[i];
+      m.label = sf.labels[i];
+      sf.series[i]->Collect(snap);
+      if (G().mux_mode) {
+        const auto at = std::lower_bound(m.label.begin(), m.label.end(), promkit::mux::kSketchLabel,
+                                         [](const auto& l, std::string_view n) { return l.name < n; });
+        m.label.insert(at, {std::string(promkit::mux::kSketchLabel), sf.marker});
+        auto& h = m.histogram;
+        h.sample_count = snap.count;
+        h.sample_sum = snap.sum;
+        std::uint64_t cum = 0;
+        for (const auto& [bound, c] : snap.window) h.bucket.push_back({cum += c, bound});
+        h.bucket.push_back({snap.count, std::numeric_limits<double>::infinity()});
+        continue;
+      }
+      auto& sm = m.summary;
+      sm.sample_count = snap.count;
+      sm.sample_sum = snap.sum;
+      for (double q : sf.quantiles) sm.quantile.push_back({q, SketchQuantile(snap.window, q, sf.schema)});
+    }
+  }
+}
+
+// promkit_series: series per exposed family (exporter.self_metrics).
+static void AppendSeriesCountsLocked(std::vector<prometheus::MetricFamily>& out) {
+  prometheus::MetricFamily f{"promkit_series", "Series exposed per metric family", prometheus::MetricType::Gauge, {}};
+  for (const auto& fam : out) {
+    auto& m = f.metric.emplace_back();
+    for (const auto& [k, v] : MergeLabels(G().cfg.labels, {{"family", fam.name}})) m.label.push_back({k, v});
+    m.gauge.value = static_cast<double>(fam.metric.size());
+  }
+  out.push_back(std::move(f));
+}
+
+std::vector<prometheus::MetricFamily> FoldingCollectable::Collect() const {
+  {
+    std::lock_guard<std::mutex> lk(G().mu);
+    FoldAllLocked();
+  }
+  auto fams = registry_->Collect();
+  std::lock_guard<std::mutex> lk(G().mu);
+  AppendNativeFamiliesLocked(fams);
+  AppendSketchFamiliesLocked(fams);
+  if (G().cfg.self_metrics) AppendSeriesCountsLocked(fams);
+  return fams;
+}
+
 static bool AllowedForMetric(const MetricSpec& spec, const std::map<std::string,std::string>& provided) {
   // Allowed keys are const_labels.keys U dyn.keys; values of dyn keys must be within the list.
   for (const auto& kv : provided) {
@@ -207,38 +659,82 @@ static bool AllowedForMetric(const MetricSpec& spec, const std::map<std::string,
   return true;
 }
 
-static void BuildDynCombos(const std::map<std::string, std::vector<std::string>>& dyn,
-                           std::vector<std::map<std::string,std::string>>& out,
-                           std::map<std::string,std::string> cur,
-                           std::map<std::string, std::vector<std::string>>::const_iterator it,
-                           std::map<std::string, std::vector<std::string>>::const_iterator end) {
-  if (it == end) {
-    out.emplace_back(std::move(cur));
-    return;
+inline constexpr std::size_t kNoSlot = static_cast<std::size_t>(-1);
+
+// Slot of the provided dynamic label values in spec's dense table, or kNoSlot
+// when a dynamic label is missing.
+static std::size_t DenseSlot(const MetricSpec& spec, const Labels& provided) {
+  std::size_t slot = 0;
+  for (std::size_t i = 0; i < spec.dyn_keys.size(); ++i) {
+    auto it = provided.find(spec.dyn_keys[i]);
+    if (it == provided.end()) return kNoSlot;
+    const auto& vals = *spec.dyn_values[i];
+    auto pos = std::find(vals.begin(), vals.end(), it->second);
+    if (pos == vals.end()) return kNoSlot;
+    slot = slot * spec.radix[i] + (spec.pinned[i] ? 0 : static_cast<std::size_t>(pos - vals.begin()));
   }
-  const auto& key = it->first;
-  const auto& vals = it->second;
-  auto next = it; ++next;
-  if (vals.empty()) {
-    BuildDynCombos(dyn, out, cur, next, end);
-    return;
+  return slot;
+}
+
+// slot with the digits of pinned keys zeroed: the slot whose series it shares.
+static std::size_t CanonicalSlot(const MetricSpec& spec, std::size_t slot) {
+  std::size_t canon = 0, scale = 1;
+  for (std::size_t rest = slot, i = spec.dyn_keys.size(); i-- > 0; rest /= spec.radix[i]) {
+    if (!spec.pinned[i]) canon += rest % spec.radix[i] * scale;
+    scale *= spec.radix[i];
   }
-  for (const auto& v : vals) {
-    auto cur2 = cur;
-    cur2.emplace(key, v);
-    BuildDynCombos(dyn, out, std::move(cur2), next, end);
+  return canon;
+}
+
+// Shared by Create*. Metrics defined in TOML resolve to their pre-registered
+// slot through dense(spec, slot), which returns 0 on a type mismatch; they never
+// get new series. Ad-hoc series: lock-free lookup; on a miss, recheck under mu
+// and create with make(), which runs under mu and returns the new id.
+template <typename Dense, typename Make>
+static std::uint64_t ResolveSeries(SeriesIndex& index, const std::string& name, const Labels& provided, Dense&& dense,
+                                   Make&& make) {
+  ReadScope rs;
+  // seq_cst: pairs with Shutdown's state store before it waits on the reader gate
+  if (G().state.load() != Backend::State::Running) return 0;
+  if (const MetricSpec* spec = FindSpec(name)) {
+    if (!AllowedForMetric(*spec, provided)) { // reject
+      CountReject(Reject::Labels);
+      return 0;
+    }
+    const auto slot = DenseSlot(*spec, provided);
+    if (slot == kNoSlot) {
+      CountReject(Reject::MissingLabel);
+      return 0;
+    }
+    const std::uint64_t id = dense(*spec, slot);
+    if (id == 0) CountReject(Reject::Type);
+    return id;
   }
+  auto stream = [&](auto&& fn) { ForEachKeyPiece(name, provided, fn); };
+  if (auto id = FindStreamed(index, stream)) return id;
+
+  std::lock_guard<std::mutex> lk(G().mu);
+  if (G().state.load(std::memory_order_relaxed) != Backend::State::Running) return 0;
+  if (auto id = FindStreamed(index, stream)) return id;
+  std::string key;
+  stream([&](std::string_view piece) { key.append(piece); });
+  return index.Insert(std::move(key), make());
 }
 
 static void PreRegisterFromFileConfig() {
   // Build MetricSpec map and pre-register all time series combinations
   for (const auto& def : G().fcfg.metrics) {
     const auto fname = FullName(G().cfg.prefix, def.name);
-    MetricSpec spec;
+    std::lock_guard<std::mutex> lk(G().mu);
+    auto [it, inserted] = G().specs.try_emplace(fname);
+    if (!inserted) continue; // first definition wins
+    MetricSpec& spec = it->second;
     spec.type = def.type;
     spec.const_labels = def.const_labels;
     spec.dyn = def.dynamic_labels;
     spec.help = def.help;
+    spec.counter_mode = def.counter_mode;
+    spec.histogram_mode = def.histogram_mode;
     spec.has_buckets = false;
     if (def.type == "histogram") {
       auto itb = G().fcfg.buckets.find(def.buckets_profile);
@@ -247,44 +743,153 @@ static void PreRegisterFromFileConfig() {
         spec.has_buckets = true;
       }
     }
-    G().specs.emplace(fname, spec);
 
-    // Pre-register
-    auto base = MergeLabels(G().cfg.labels, def.const_labels);
-    std::vector<std::map<std::string,std::string>> combos;
-    if (!def.dynamic_labels.empty()) {
-      BuildDynCombos(def.dynamic_labels, combos, {}, def.dynamic_labels.begin(), def.dynamic_labels.end());
-    } else {
-      combos.emplace_back(std::map<std::string,std::string>{});
+    // Dense layout over the dynamic label values
+    std::size_t n = 1;
+    for (const auto& [k, vals] : spec.dyn) {
+      if (vals.empty()) continue;
+      spec.dyn_keys.push_back(k);
+      spec.dyn_values.push_back(&vals);
+      spec.radix.push_back(static_cast<std::uint32_t>(vals.size()));
+      n *= vals.size();
     }
+    spec.series_count = n;
+
+    // One label map reused for every slot: dynamic values are rewritten in
+    // place, except where a global/const label of the same key already wins.
+    // Slots differing only in such keys would be the same series: only their
+    // canonical slot gets one and the others are never handed out.
+    auto labels = MergeLabels(G().cfg.labels, def.const_labels);
+    spec.pinned.resize(spec.dyn_keys.size());
+    for (std::size_t i = 0; i < spec.pinned.size(); ++i) spec.pinned[i] = labels.count(spec.dyn_keys[i]) != 0;
+    auto labelsFor = [&](std::size_t slot) -> const Labels& {
+      for (std::size_t rest = slot, i = spec.dyn_keys.size(); i-- > 0; rest /= spec.radix[i]) {
+        if (!spec.pinned[i]) labels[spec.dyn_keys[i]] = (*spec.dyn_values[i])[rest % spec.radix[i]];
+      }
+      return labels;
+    };
+    auto canonical = [&](std::size_t slot) { return CanonicalSlot(spec, slot) == slot; };
 
-    std::lock_guard<std::mutex> lk(G().mu);
     if (def.type == "counter") {
       auto& fam = GetOrMakeCounterFam(fname, def.help);
-      for (const auto& d : combos) {
-        auto labels = MergeLabels(base, d);
-        auto& ref = fam.Add(labels);
-        G().counter_series.emplace(fname + "|" + LabelsKey(labels), &ref);
+      auto* block = NewCounterBlockLocked(CounterModeFor(&spec), n);
+      auto* local = NewLocalBlockLocked(CounterModeFor(&spec), n);
+      spec.counters = std::make_unique<CounterSeries[]>(n);
+      for (std::size_t slot = 0; slot < n; ++slot) {
+        auto& s = spec.counters[slot];
+        s.sink = &fam.Add(labelsFor(slot));
+        s.shards = block;
+        s.local = local;
+        s.col = static_cast<std::uint32_t>(slot);
       }
     } else if (def.type == "gauge") {
       auto& fam = GetOrMakeGaugeFam(fname, def.help);
-      for (const auto& d : combos) {
-        auto labels = MergeLabels(base, d);
-        auto& ref = fam.Add(labels);
-        G().gauge_series.emplace(fname + "|" + LabelsKey(labels), &ref);
+      spec.gauges = std::make_unique<GaugeSeries[]>(n);
+      for (std::size_t slot = 0; slot < n; ++slot) {
+        if (canonical(slot)) spec.gauges[slot].sink = &fam.Add(labelsFor(slot));
+      }
+    } else if (def.type == "histogram" && HistogramModeFor(&spec) == "native") {
+      auto& nf = G().natives[fname];
+      nf.help = def.help;
+      nf.schema.schema = std::clamp(def.native_schema, kNativeMinSchema, kNativeMaxSchema);
+      if (def.native_zero_threshold > 0) nf.schema.zero_threshold = def.native_zero_threshold;
+      spec.histograms = std::make_unique<HistogramSeries[]>(n);
+      for (std::size_t slot = 0; slot < n; ++slot) {
+        if (!canonical(slot)) {
+          spec.histograms[slot].native = spec.histograms[CanonicalSlot(spec, slot)].native;
+          continue;
+        }
+        std::vector<prometheus::ClientMetric::Label> ls;
+        for (const auto& [k, v] : labelsFor(slot)) ls.push_back({k, v});
+        nf.labels.push_back(std::move(ls));
+        auto& h = nf.series.emplace_back(std::make_unique<NativeHistogram>(nf.schema.schema, nf.schema.zero_threshold));
+        spec.histograms[slot].native = h.get();
+      }
+    } else if (def.type == "summary") {
+      auto& sf = GetOrMakeSketchFamLocked(fname, def.help, def);
+      spec.summaries.reserve(n);
+      for (std::size_t slot = 0; slot < n; ++slot) {
+        spec.summaries.push_back(canonical(slot) ? AddSketchLocked(sf, labelsFor(slot))
+                                                 : spec.summaries[CanonicalSlot(spec, slot)]);
       }
     } else if (def.type == "histogram") {
       auto& fam = GetOrMakeHistFam(fname, def.help);
       const auto& buckets = spec.has_buckets ? spec.buckets : DefaultLatencyBuckets();
-      for (const auto& d : combos) {
-        auto labels = MergeLabels(base, d);
-        auto& ref = fam.Add(labels, buckets);
-        G().hist_series.emplace(fname + "|" + LabelsKey(labels), &ref);
+      auto* block = NewHistBlockLocked(HistogramModeFor(&spec), n, buckets);
+      spec.histograms = std::make_unique<HistogramSeries[]>(n);
+      for (std::size_t slot = 0; slot < n; ++slot) {
+        BindHistogram(spec.histograms[slot], fam.Add(labelsFor(slot), buckets), block, slot);
       }
     }
+    // Publish once the table is complete; lock-free readers may pick it up right away.
+    G().spec_index.Insert(fname, reinterpret_cast<std::uint64_t>(&spec));
+  }
+  {
+    auto schemas = std::make_shared<NativeSchemas>();
+    std::lock_guard<std::mutex> lk(G().mu);
+    for (const auto& [name, nf] : G().natives) schemas->emplace(name, nf.schema);
+    G().native_schemas = std::move(schemas);
+  }
+
+  // Aggregator: the [[metrics]] publish/gauge_agg policies decide the merged output
+  if (G().mux_collectable) {
+    promkit::mux::MergePolicies policies;
+    for (const auto& def : G().fcfg.metrics) {
+      auto policy = promkit::mux::MakeMergePolicy(def.type, def.publish, def.gauge_agg);
+      if (def.type == "summary") {
+        policy.quantiles = def.quantiles;
+        policy.sketch_schema = SketchSchema(def.relative_accuracy);
+      }
+      policies.try_emplace(FullName(G().cfg.prefix, def.name), std::move(policy));
+    }
+    G().mux_collectable->SetPolicies(std::move(policies));
   }
 }
 
+// Renders source into the scrape body, text through a per-server template
+// cache or protobuf; a body younger than scrape_cache_ms is served again as is.
+// A mux merge is rendered in place rather than copied out by Collect.
+static MetricsServer::Handler MakeScrapeHandler(std::shared_ptr<prometheus::Collectable> source) {
+  auto mux = std::dynamic_pointer_cast<promkit::mux::MuxCollector>(source);
+  // The histograms outlive the server: the registry is torn down after it.
+  prometheus::Histogram* text_seconds = G().scrape_seconds[0];
+  prometheus::Histogram* proto_seconds = G().scrape_seconds[1];
+  auto render = std::make_shared<ExpositionCache>();
+  auto text = std::make_shared<FreshCache<std::string>>();
+  auto proto = std::make_shared<FreshCache<std::string>>();
+  text->SetWindow(std::chrono::milliseconds(std::max(0, G().cfg.scrape_cache_ms)));
+  proto->SetWindow(std::chrono::milliseconds(std::max(0, G().cfg.scrape_cache_ms)));
+  return [source = std::move(source), mux, render, text, proto, text_seconds, proto_seconds](MetricsServer::Format format) {
+    const auto t0 = std::chrono::steady_clock::now();
+    auto timed = [&](prometheus::Histogram* h) {
+      if (h) h->Observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    };
+    auto collect = [&] {
+      return mux ? mux->Snapshot() : std::make_shared<const std::vector<prometheus::MetricFamily>>(source->Collect());
+    };
+    if (format == MetricsServer::Format::kProtobuf) {
+      return proto->Get([&] {
+        const auto fams = collect();
+        std::shared_ptr<const NativeSchemas> natives;
+        {
+          std::lock_guard<std::mutex> lk(G().mu);
+          natives = G().native_schemas;
+        }
+        std::string body;
+        RenderProtobuf(*fams, body, natives.get());
+        timed(proto_seconds);
+        return body;
+      });
+    }
+    return text->Get([&] {
+      std::string body;
+      render->Render(*collect(), body);
+      timed(text_seconds);
+      return body;
+    });
+  };
+}
+
 } // namespace
 
 bool Init(const Config& cfg) noexcept {
@@ -298,37 +903,57 @@ bool Init(const Config& cfg) noexcept {
 
     G().cfg = cfg;
     G().mux_mode = (cfg.mode == "mux");
+    // Fix the tick rate before any series converts bucket bounds to ticks;
+    // the first Init's choice holds for the process.
+    SelectTickClock(cfg.timer_clock == "tsc");
     if (!cfg.enabled) {
       G().state.store(Backend::State::Stopped, std::memory_order_release);
       return true; // disabled: still succeed
     }
 
     G().registry = std::make_shared<prometheus::Registry>();
+    G().collectable = std::make_shared<FoldingCollectable>(G().registry);
+    if (cfg.self_metrics) {
+      std::lock_guard<std::mutex> lk(G().mu);
+      RegisterSelfMetricsLocked();
+    }
+
+    const std::string path = cfg.path.empty() ? std::string{"/metrics"} : cfg.path;
 
     // mux mode: try aggregator first
     if (G().mux_mode) {
       try {
         // Try binding public port as aggregator
-        std::string addr = cfg.host + ":" + std::to_string(cfg.port);
-        G().exposer = std::make_unique<prometheus::Exposer>(addr);
-        G().exposer->RegisterCollectable(G().registry, cfg.path.empty() ? std::string{"/metrics"} : cfg.path);
-        // Register mux collector to same path
         G().mux_dir = BuildMuxDir(cfg);
         EnsureDir(G().mux_dir);
-        G().mux_collectable = std::make_shared<promkit::mux::MuxCollector>();
-        G().mux_collectable->SetDirectory(G().mux_dir);
-        // 璁╄仛鍚堝櫒鑷韩涔熶互 component 韬唤鍔犲叆鍚堝苟
-        G().mux_collectable->SetSelf(G().registry, MuxComponentName(cfg));
-        G().exposer->RegisterCollectable(G().mux_collectable, cfg.path.empty() ? std::string{"/metrics"} : cfg.path);
+        auto mux = std::make_shared<promkit::mux::MuxCollector>();
+        mux->SetDirectory(G().mux_dir);
+        mux->SetTimeouts(std::chrono::milliseconds(cfg.mux_worker_timeout_ms),
+                         std::chrono::milliseconds(cfg.mux_scrape_budget_ms));
+        mux->SetCacheWindow(std::chrono::milliseconds(std::max(0, cfg.scrape_cache_ms)));
+        mux->SetSelfMetrics(cfg.self_metrics);
+        mux->SetLabels(cfg.labels);
+        // 璁╄仛鍚堝櫒鑷韩涔熶互 component 韬唤鍔犲叆鍚堝苟
+        mux->SetSelf(G().collectable, MuxComponentName(cfg));
+        // The mux merge already carries our own registry: serve only the merge
+        G().server = std::make_unique<MetricsServer>(cfg.host, cfg.port, path, MakeScrapeHandler(mux), cfg.gzip_level);
+        G().mux_collectable = std::move(mux);
         G().mux_aggregator = true;
       } catch (...) {
         // Aggregator failed; become worker
-        G().exposer.reset();
-        std::string addr_local = std::string{"127.0.0.1:"} + std::to_string(0);
-        G().exposer = std::make_unique<prometheus::Exposer>(addr_local);
-        G().exposer->RegisterCollectable(G().registry, cfg.path.empty() ? std::string{"/metrics"} : cfg.path);
-        auto ports = G().exposer->GetListeningPorts();
-        int port = ports.empty() ? 0 : ports.front();
+        G().server.reset();
+        G().mux_collectable.reset();
+        if (cfg.mux_transport == "shm") {
+          G().mux_dir = BuildMuxDir(cfg);
+          if (StartShmWorker(cfg)) {
+            G().mux_aggregator = false;
+            G().state.store(Backend::State::Running, std::memory_order_release);
+            return true;
+          }
+          StopShmWorker(); // not available here: fall back to an HTTP worker
+        }
+        G().server = std::make_unique<MetricsServer>("127.0.0.1", 0, path, MakeScrapeHandler(G().collectable));
+        int port = G().server->port();
         if (port <= 0) throw std::runtime_error("failed to bind ephemeral port for worker");
         G().mux_dir = BuildMuxDir(cfg);
         G().mux_worker_file = WriteWorkerDescriptor(cfg, G().mux_dir, port);
@@ -337,19 +962,11 @@ bool Init(const Config& cfg) noexcept {
         G().state.store(Backend::State::Running, std::memory_order_release);
         return true;
       }
-
-      // Aggregator success: register mux collector
-      try {
-        // Defer include to avoid header dependency error
-        // We include header here
-      } catch (...) {}
     }
 
-    // single mode or mux aggregator fallback path: normal exposer
-    if (!G().exposer) {
-      std::string addr = cfg.host + ":" + std::to_string(cfg.port);
-      G().exposer = std::make_unique<prometheus::Exposer>(addr);
-      G().exposer->RegisterCollectable(G().registry, cfg.path.empty() ? std::string{"/metrics"} : cfg.path);
+    // single mode
+    if (!G().server) {
+      G().server = std::make_unique<MetricsServer>(cfg.host, cfg.port, path, MakeScrapeHandler(G().collectable), cfg.gzip_level);
     }
 
     G().state.store(Backend::State::Running, std::memory_order_release);
@@ -376,6 +993,16 @@ bool InitFromToml(const std::string& toml_path) noexcept {
     cfg.path    = fcfg.path;
     cfg.prefix  = fcfg.ns;
     cfg.labels  = fcfg.labels;
+    cfg.counter_mode = fcfg.counter_mode;
+    cfg.histogram_mode = fcfg.histogram_mode;
+    cfg.timer_clock = fcfg.timer_clock;
+    cfg.mux_transport = fcfg.mux_transport;
+    cfg.mux_publish_ms = fcfg.mux_publish_ms;
+    cfg.mux_worker_timeout_ms = fcfg.mux_worker_timeout_ms;
+    cfg.mux_scrape_budget_ms = fcfg.mux_scrape_budget_ms;
+    cfg.scrape_cache_ms = fcfg.scrape_cache_ms;
+    cfg.gzip_level = fcfg.gzip_level;
+    cfg.self_metrics = fcfg.self_metrics;
     if (!Init(cfg)) return false;
 
     // Save config and pre-register time series based on definitions
@@ -392,9 +1019,13 @@ bool InitFromToml(const std::string& toml_path) noexcept {
 
 void Shutdown() noexcept {
   try {
-    // Transition to shutting down to gate all API calls.
-    G().state.store(Backend::State::ShuttingDown, std::memory_order_release);
+    // Transition to shutting down to gate all API calls (seq_cst: see ResolveSeries).
+    G().state.store(Backend::State::ShuttingDown);
     G().cfg.enabled = false; // extra guard for older checks
+    // Let lock-free lookups that passed the state check finish before clearing.
+    G().readers.Wait();
+    // The shm publisher collects the registry: stop it before clearing.
+    StopShmWorker();
 
     // Clear caches under lock so concurrent creators won't deref stale pointers.
     {
@@ -411,7 +1042,9 @@ void Shutdown() noexcept {
     } catch (...) {}
 
     // Tear down prometheus-cpp objects after caches are cleared.
-    G().exposer.reset();
+    G().server.reset();
+    G().mux_collectable.reset();
+    G().collectable.reset();
     G().registry.reset();
 
     G().state.store(Backend::State::Stopped, std::memory_order_release);
@@ -432,27 +1065,20 @@ CounterId CreateCounter(const std::string& name, const std::string& help,
                         const std::map<std::string, std::string>& const_labels) noexcept {
   if (!G().cfg.enabled || G().state.load(std::memory_order_acquire) != Backend::State::Running) return 0;
   try {
-    const auto fname = FullName(G().cfg.prefix, name);
-    std::map<std::string, std::string> final_labels = MergeLabels(G().cfg.labels, const_labels);
-
-    std::lock_guard<std::mutex> lk(G().mu);
-    if (G().state.load(std::memory_order_relaxed) != Backend::State::Running) return 0;
-    // If spec exists, enforce allowed labels and inject spec.const_labels
-    auto sit = G().specs.find(fname);
-    if (sit != G().specs.end()) {
-      for (const auto& kv : sit->second.const_labels) final_labels.emplace(kv.first, kv.second);
-      if (!AllowedForMetric(sit->second, const_labels)) return 0; // reject
-      const auto key = fname + "|" + LabelsKey(final_labels);
-      if (auto ts = G().counter_series.find(key); ts != G().counter_series.end()) {
-        return reinterpret_cast<CounterId>(ts->second);
-      }
-      // If not found, and metric was defined, do not create new dynamic series; reject
-      return 0;
-    }
-    // No spec: create ad-hoc
-    auto& fam = GetOrMakeCounterFam(fname, help);
-    auto& ref = fam.Add(final_labels);
-    return reinterpret_cast<CounterId>(&ref);
+    return ResolveSeries(
+        G().counter_index, name, const_labels,
+        [](const MetricSpec& spec, std::size_t slot) {
+          return spec.counters ? reinterpret_cast<CounterId>(&spec.counters[slot]) : CounterId{0};
+        },
+        [&] {
+          // No spec: create ad-hoc
+          auto& fam = GetOrMakeCounterFam(FullName(G().cfg.prefix, name), help);
+          auto& s = G().counter_store.emplace_back();
+          s.sink = &fam.Add(MergeLabels(G().cfg.labels, const_labels));
+          s.shards = NewCounterBlockLocked(CounterModeFor(nullptr), 1);
+          s.local = NewLocalBlockLocked(CounterModeFor(nullptr), 1);
+          return reinterpret_cast<CounterId>(&s);
+        });
   } catch (...) {
     return 0;
   }
@@ -460,31 +1086,28 @@ CounterId CreateCounter(const std::string& name, const std::string& help,
 
 void CounterAdd(CounterId id, double value) noexcept {
   if (!G().cfg.enabled || id == 0 || G().state.load(std::memory_order_acquire) != Backend::State::Running) return;
-  auto* c = reinterpret_cast<prometheus::Counter*>(id);
-  if (value > 0) c->Increment(value);
+  auto* s = reinterpret_cast<CounterSeries*>(id);
+  if (!(value > 0)) return;
+  if (s->local) s->local->Add(s->col, value);
+  else if (s->shards) s->shards->Add(s->col, value);
+  else s->value.fetch_add(value, std::memory_order_relaxed);
 }
 
 GaugeId CreateGauge(const std::string& name, const std::string& help,
                     const std::map<std::string, std::string>& const_labels) noexcept {
   if (!G().cfg.enabled || G().state.load(std::memory_order_acquire) != Backend::State::Running) return 0;
   try {
-    const auto fname = FullName(G().cfg.prefix, name);
-    std::map<std::string, std::string> final_labels = MergeLabels(G().cfg.labels, const_labels);
-    std::lock_guard<std::mutex> lk(G().mu);
-    if (G().state.load(std::memory_order_relaxed) != Backend::State::Running) return 0;
-    auto sit = G().specs.find(fname);
-    if (sit != G().specs.end()) {
-      for (const auto& kv : sit->second.const_labels) final_labels.emplace(kv.first, kv.second);
-      if (!AllowedForMetric(sit->second, const_labels)) return 0;
-      const auto key = fname + "|" + LabelsKey(final_labels);
-      if (auto ts = G().gauge_series.find(key); ts != G().gauge_series.end()) {
-        return reinterpret_cast<GaugeId>(ts->second);
-      }
-      return 0;
-    }
-    auto& fam = GetOrMakeGaugeFam(fname, help);
-    auto& ref = fam.Add(final_labels);
-    return reinterpret_cast<GaugeId>(&ref);
+    return ResolveSeries(
+        G().gauge_index, name, const_labels,
+        [](const MetricSpec& spec, std::size_t slot) {
+          return spec.gauges ? reinterpret_cast<GaugeId>(&spec.gauges[slot]) : GaugeId{0};
+        },
+        [&] {
+          auto& fam = GetOrMakeGaugeFam(FullName(G().cfg.prefix, name), help);
+          auto& s = G().gauge_store.emplace_back();
+          s.sink = &fam.Add(MergeLabels(G().cfg.labels, const_labels));
+          return reinterpret_cast<GaugeId>(&s);
+        });
   } catch (...) {
     return 0;
   }
@@ -492,14 +1115,12 @@ GaugeId CreateGauge(const std::string& name, const std::string& help,
 
 void GaugeSet(GaugeId id, double value) noexcept {
   if (!G().cfg.enabled || id == 0 || G().state.load(std::memory_order_acquire) != Backend::State::Running) return;
-  auto* g = reinterpret_cast<prometheus::Gauge*>(id);
-  g->Set(value);
+  reinterpret_cast<GaugeSeries*>(id)->value.store(value, std::memory_order_relaxed);
 }
 
 void GaugeAdd(GaugeId id, double delta) noexcept {
   if (!G().cfg.enabled || id == 0 || G().state.load(std::memory_order_acquire) != Backend::State::Running) return;
-  auto* g = reinterpret_cast<prometheus::Gauge*>(id);
-  if (delta >= 0) g->Increment(delta); else g->Decrement(-delta);
+  reinterpret_cast<GaugeSeries*>(id)->value.fetch_add(delta, std::memory_order_relaxed);
 }
 
 HistogramId CreateHistogram(const std::string& name, const std::string& help,
@@ -507,24 +1128,19 @@ HistogramId CreateHistogram(const std::string& name, const std::string& help,
                             const std::map<std::string, std::string>& const_labels) noexcept {
   if (!G().cfg.enabled || G().state.load(std::memory_order_acquire) != Backend::State::Running) return 0;
   try {
-    const auto fname = FullName(G().cfg.prefix, name);
-    std::map<std::string, std::string> final_labels = MergeLabels(G().cfg.labels, const_labels);
-    std::lock_guard<std::mutex> lk(G().mu);
-    if (G().state.load(std::memory_order_relaxed) != Backend::State::Running) return 0;
-    auto sit = G().specs.find(fname);
-    if (sit != G().specs.end()) {
-      for (const auto& kv : sit->second.const_labels) final_labels.emplace(kv.first, kv.second);
-      if (!AllowedForMetric(sit->second, const_labels)) return 0;
-      const auto key = fname + "|" + LabelsKey(final_labels);
-      if (auto ts = G().hist_series.find(key); ts != G().hist_series.end()) {
-        return reinterpret_cast<HistogramId>(ts->second);
-      }
-      return 0;
-    }
-    auto& fam = GetOrMakeHistFam(fname, help);
-    const auto& used_buckets = buckets.empty() ? DefaultLatencyBuckets() : buckets;
-    auto& ref = fam.Add(final_labels, used_buckets);
-    return reinterpret_cast<HistogramId>(&ref);
+    return ResolveSeries(
+        G().hist_index, name, const_labels,
+        [](const MetricSpec& spec, std::size_t slot) {
+          return spec.histograms ? reinterpret_cast<HistogramId>(&spec.histograms[slot]) : HistogramId{0};
+        },
+        [&] {
+          auto& fam = GetOrMakeHistFam(FullName(G().cfg.prefix, name), help);
+          const auto& used_buckets = buckets.empty() ? DefaultLatencyBuckets() : buckets;
+          auto& s = G().hist_store.emplace_back();
+          BindHistogram(s, fam.Add(MergeLabels(G().cfg.labels, const_labels), used_buckets),
+                        NewHistBlockLocked(HistogramModeFor(nullptr), 1, used_buckets), 0);
+          return reinterpret_cast<HistogramId>(&s);
+        });
   } catch (...) {
     return 0;
   }
@@ -532,8 +1148,130 @@ HistogramId CreateHistogram(const std::string& name, const std::string& help,
 
 void HistogramObserve(HistogramId id, double value) noexcept {
   if (!G().cfg.enabled || id == 0 || G().state.load(std::memory_order_acquire) != Backend::State::Running) return;
-  auto* h = reinterpret_cast<prometheus::Histogram*>(id);
-  h->Observe(value);
+  auto* s = reinterpret_cast<HistogramSeries*>(id);
+  if (s->native) s->native->Observe(value);
+  else if (s->shards) s->shards->Observe(s->col, value);
+  else s->sink->Observe(value);
+}
+
+void HistogramObserveTicks(HistogramId id, std::uint64_t ticks) noexcept {
+  if (!G().cfg.enabled || id == 0 || G().state.load(std::memory_order_acquire) != Backend::State::Running) return;
+  auto* s = reinterpret_cast<HistogramSeries*>(id);
+  if (s->native) s->native->Observe(static_cast<double>(ticks) * SecondsPerTick());
+  else if (s->shards) s->shards->ObserveTicks(s->col, ticks);
+  else s->sink->Observe(static_cast<double>(ticks) * SecondsPerTick());
+}
+
+SummaryId CreateSummary(const std::string& name, const std::string& help,
+                        const std::map<std::string, std::string>& const_labels) noexcept {
+  if (!G().cfg.enabled || G().state.load(std::memory_order_acquire) != Backend::State::Running) return 0;
+  try {
+    return ResolveSeries(
+        G().summary_index, name, const_labels,
+        [](const MetricSpec& spec, std::size_t slot) {
+          return spec.summaries.empty() ? SummaryId{0} : reinterpret_cast<SummaryId>(spec.summaries[slot]);
+        },
+        [&] {
+          auto& sf = GetOrMakeSketchFamLocked(FullName(G().cfg.prefix, name), help, MetricDef{});
+          return reinterpret_cast<SummaryId>(AddSketchLocked(sf, MergeLabels(G().cfg.labels, const_labels)));
+        });
+  } catch (...) {
+    return 0;
+  }
+}
+
+void SummaryObserve(SummaryId id, double value) noexcept {
+  if (!G().cfg.enabled || id == 0 || G().state.load(std::memory_order_acquire) != Backend::State::Running) return;
+  reinterpret_cast<QuantileSketch*>(id)->Observe(value);
+}
+
+void RecordBatch(const BatchOp* ops, std::size_t n) noexcept {
+  if (!G().cfg.enabled || G().state.load(std::memory_order_acquire) != Backend::State::Running) return;
+  // Claimed on the first sharded series only, so atomic-only batches keep no slot.
+  std::uint32_t shard = detail::kNoShard;
+  auto myShard = [&] { return shard != detail::kNoShard ? shard : (shard = CurrentShard()); };
+  for (std::size_t i = 0; i < n; ++i) {
+    const BatchOp& op = ops[i];
+    if (op.id == 0) continue;
+    switch (op.kind) {
+      case BatchOpKind::CounterAdd: {
+        auto* s = reinterpret_cast<CounterSeries*>(op.id);
+        if (!(op.value > 0)) break;
+        if (s->local) s->local->Add(s->col, op.value);
+        else if (s->shards) s->shards->AddOn(myShard(), s->col, op.value);
+        else s->value.fetch_add(op.value, std::memory_order_relaxed);
+        break;
+      }
+      case BatchOpKind::GaugeSet:
+        reinterpret_cast<GaugeSeries*>(op.id)->value.store(op.value, std::memory_order_relaxed);
+        break;
+      case BatchOpKind::GaugeAdd:
+        reinterpret_cast<GaugeSeries*>(op.id)->value.fetch_add(op.value, std::memory_order_relaxed);
+        break;
+      case BatchOpKind::HistogramObserve: {
+        auto* s = reinterpret_cast<HistogramSeries*>(op.id);
+        if (s->native) s->native->Observe(op.value);
+        else if (s->shards) s->shards->ObserveOn(myShard(), s->col, op.value);
+        else s->sink->Observe(op.value);
+        break;
+      }
+      case BatchOpKind::HistogramObserveTicks: {
+        auto* s = reinterpret_cast<HistogramSeries*>(op.id);
+        if (s->native) s->native->Observe(static_cast<double>(op.ticks) * SecondsPerTick());
+        else if (s->shards) s->shards->ObserveTicksOn(myShard(), s->col, op.ticks);
+        else s->sink->Observe(static_cast<double>(op.ticks) * SecondsPerTick());
+        break;
+      }
+      case BatchOpKind::SummaryObserve:
+        reinterpret_cast<QuantileSketch*>(op.id)->Observe(op.value);
+        break;
+    }
+  }
+}
+
+bool ResolveFamily(MetricKind kind, const std::string& name, const std::vector<std::string>& keys,
+                   std::vector<std::uint64_t>& ids, std::vector<std::uint32_t>& radix) noexcept {
+  ids.clear();
+  radix.clear();
+  if (!G().cfg.enabled || G().state.load(std::memory_order_acquire) != Backend::State::Running) return false;
+  try {
+    ReadScope rs;
+    if (G().state.load() != Backend::State::Running) return false;
+    const MetricSpec* spec = FindSpec(name);
+    static constexpr const char* kTypes[] = {"counter", "gauge", "histogram", "summary"};
+    if (!spec || spec->type != kTypes[static_cast<int>(kind)] || keys.size() != spec->dyn_keys.size()) return false;
+    // requested key i -> dimension pos[i] of the spec's dense table
+    std::vector<std::size_t> pos;
+    for (const auto& k : keys) {
+      auto it = std::find(spec->dyn_keys.begin(), spec->dyn_keys.end(), k);
+      const auto d = static_cast<std::size_t>(it - spec->dyn_keys.begin());
+      if (it == spec->dyn_keys.end() || std::find(pos.begin(), pos.end(), d) != pos.end()) {
+        radix.clear();
+        return false;
+      }
+      pos.push_back(d);
+      radix.push_back(spec->radix[d]);
+    }
+    ids.assign(spec->series_count, 0);
+    std::vector<std::size_t> digit(keys.size());
+    for (std::size_t idx = 0; idx < ids.size(); ++idx) {
+      // decode idx in the requested key order, re-encode in the table's order
+      for (std::size_t rest = idx, i = keys.size(); i-- > 0; rest /= radix[i]) digit[pos[i]] = rest % radix[i];
+      std::size_t slot = 0;
+      for (std::size_t d = 0; d < digit.size(); ++d) slot = slot * spec->radix[d] + (spec->pinned[d] ? 0 : digit[d]);
+      switch (kind) {
+        case MetricKind::Counter: ids[idx] = reinterpret_cast<std::uint64_t>(&spec->counters[slot]); break;
+        case MetricKind::Gauge: ids[idx] = reinterpret_cast<std::uint64_t>(&spec->gauges[slot]); break;
+        case MetricKind::Histogram: ids[idx] = reinterpret_cast<std::uint64_t>(&spec->histograms[slot]); break;
+        case MetricKind::Summary: ids[idx] = reinterpret_cast<std::uint64_t>(spec->summaries[slot]); break;
+      }
+    }
+    return true;
+  } catch (...) {
+    ids.clear();
+    radix.clear();
+    return false;
+  }
 }
 
 } // namespace promkit
@@ -552,6 +1290,11 @@ void GaugeSet(GaugeId, double) noexcept {}
 void GaugeAdd(GaugeId, double) noexcept {}
 HistogramId CreateHistogram(const std::string&, const std::string&, const std::vector<double>&, const std::map<std::string, std::string>&) noexcept { return 0; }
 void HistogramObserve(HistogramId, double) noexcept {}
+void HistogramObserveTicks(HistogramId, std::uint64_t) noexcept {}
+SummaryId CreateSummary(const std::string&, const std::string&, const std::map<std::string, std::string>&) noexcept { return 0; }
+void SummaryObserve(SummaryId, double) noexcept {}
+void RecordBatch(const BatchOp*, std::size_t) noexcept {}
+bool ResolveFamily(MetricKind, const std::string&, const std::vector<std::string>&, std::vector<std::uint64_t>&, std::vector<std::uint32_t>&) noexcept { return false; }
 } // namespace promkit
 
 #endif
@@ -0,0 +1,242 @@
+// promkit-bench: ns/op of the recording calls and Create* lookups, 1..N threads, as JSON
+//
+//   promkit-bench [--threads N] [--ms M] [--clock steady|tsc] [--filter S] [--out file.json]
+//
+// Every case runs for M ms at each thread count 1, 2, 4, ... N. "shared" cases
+// have all threads record into one series; "per_thread" cases give each thread
+// its own series of the same metric. Metrics come from a generated TOML with
+// one entry per counter/histogram mode, so a case name reads
+// <call>/<mode>/<shared|per_thread>.
+#include <promkit/promkit.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+  int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  int ms = 200;
+  std::string clock = "steady";
+  std::string filter;
+  std::string out;
+};
+
+struct Result {
+  std::string name;
+  int threads;
+  std::uint64_t ops;
+  double ns_per_op;  // wall time per op and thread
+  double mops_per_s; // all threads
+};
+
+const char* const kCounterModes[] = {"atomic", "sharded", "local"};
+const char* const kHistogramModes[] = {"atomic", "sharded", "native"};
+
+std::string WriteConfig(const Options& o) {
+  std::ostringstream t;
+  t << "[";
+  for (int i = 0; i < o.threads; ++i) t << (i ? ", " : "") << '"' << i << '"';
+  t << "]";
+  const std::string labels = "dynamic_labels = { t = " + t.str() + " }\n";
+  std::ostringstream s;
+  s << "[exporter]\nenabled = true\nmode = \"single\"\nhost = \"127.0.0.1\"\nport = 0\nnamespace = \"bench\"\n"
+    << "timer_clock = \"" << o.clock << "\"\n\n[labels]\ncomponent = \"bench\"\n\n";
+  for (const char* m : kCounterModes) {
+    s << "[[metrics]]\nname = \"counter_" << m << "\"\ntype = \"counter\"\ncounter_mode = \"" << m << "\"\n" << labels << "\n";
+  }
+  for (const char* m : kHistogramModes) {
+    s << "[[metrics]]\nname = \"histogram_" << m << "\"\ntype = \"histogram\"\nhistogram_mode = \"" << m << "\"\n"
+      << labels << "\n";
+  }
+  s << "[[metrics]]\nname = \"gauge\"\ntype = \"gauge\"\n" << labels << "\n";
+  s << "[[metrics]]\nname = \"summary\"\ntype = \"summary\"\n" << labels << "\n";
+  const auto path = (std::filesystem::temp_directory_path() / "promkit-bench.toml").string();
+  std::ofstream(path) << s.str();
+  return path;
+}
+
+// Runs op(thread index) on `threads` threads for o.ms. make(t) runs on thread t
+// before the clock starts and returns the op it then repeats.
+template <typename Make>
+Result Run(const Options& o, const std::string& name, int threads, Make&& make) {
+  constexpr int kChunk = 256; // ops between stop checks
+  std::atomic<int> ready{0};
+  std::atomic<bool> go{false}, stop{false};
+  std::vector<std::uint64_t> ops(static_cast<std::size_t>(threads) * 8); // one cache line apart
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; ++t) {
+    pool.emplace_back([&, t] {
+      auto op = make(t);
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+      std::uint64_t n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < kChunk; ++i) op();
+        n += kChunk;
+      }
+      ops[static_cast<std::size_t>(t) * 8] = n;
+    });
+  }
+  while (ready.load() != threads) std::this_thread::yield();
+  const auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(std::chrono::milliseconds(o.ms));
+  stop.store(true);
+  for (auto& th : pool) th.join();
+  const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  std::uint64_t total = 0;
+  for (int t = 0; t < threads; ++t) total += ops[static_cast<std::size_t>(t) * 8];
+  return {name, threads, total, ns * threads / static_cast<double>(total), static_cast<double>(total) / ns * 1e3};
+}
+
+std::string Json(const Options& o, const std::vector<Result>& results) {
+  char date[32];
+  const std::time_t now = std::time(nullptr);
+  std::strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+  std::ostringstream s;
+  s.precision(6);
+  s << "{\n  \"context\": {\"date\": \"" << date << "\", \"max_threads\": " << o.threads
+    << ", \"duration_ms\": " << o.ms << ", \"timer_clock\": \"" << o.clock
+    << "\", \"hardware_concurrency\": " << std::thread::hardware_concurrency() << "},\n  \"benchmarks\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    s << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"threads\": " << r.threads << ", \"ops\": " << r.ops
+      << ", \"ns_per_op\": " << r.ns_per_op << ", \"mops_per_s\": " << r.mops_per_s << "}";
+  }
+  s << "\n  ]\n}\n";
+  return s.str();
+}
+
+bool ParseArgs(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string a = argv[i];
+    if (i + 1 >= argc) return false;
+    const std::string v = argv[++i];
+    if (a == "--threads") o.threads = std::max(1, std::stoi(v));
+    else if (a == "--ms") o.ms = std::max(1, std::stoi(v));
+    else if (a == "--clock") o.clock = v;
+    else if (a == "--filter") o.filter = v;
+    else if (a == "--out") o.out = v;
+    else return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  try {
+    if (!ParseArgs(argc, argv, o)) {
+      std::cerr << "usage: " << argv[0] << " [--threads N] [--ms M] [--clock steady|tsc] [--filter S] [--out file]\n";
+      return 2;
+    }
+  } catch (...) {
+    std::cerr << "bad argument value\n";
+    return 2;
+  }
+  if (!promkit::InitFromToml(WriteConfig(o))) {
+    std::cerr << "InitFromToml failed\n";
+    return 1;
+  }
+
+  std::vector<Result> results;
+  auto series = [](int t) { return std::map<std::string, std::string>{{"t", std::to_string(t)}}; };
+  // Runs one case at each thread count, skipping names without the filter.
+  auto scale = [&](const std::string& name, auto&& make) {
+    if (!o.filter.empty() && name.find(o.filter) == std::string::npos) return;
+    for (int n = 1;; n = std::min(n * 2, o.threads)) {
+      results.push_back(Run(o, name, n, make));
+      std::cerr << name << " threads=" << n << " " << results.back().ns_per_op << " ns/op\n";
+      if (n == o.threads) break;
+    }
+  };
+  for (const char* sharing : {"shared", "per_thread"}) {
+    const bool shared = sharing[0] == 's';
+    auto label = [&](int t) { return series(shared ? 0 : t); };
+    for (const char* m : kCounterModes) {
+      const std::string metric = std::string("counter_") + m;
+      scale(std::string("CounterAdd/") + m + "/" + sharing, [&](int t) {
+        auto id = promkit::CreateCounter(metric, "", label(t));
+        return [id] { promkit::CounterAdd(id, 1); };
+      });
+    }
+    scale(std::string("GaugeSet/atomic/") + sharing, [&](int t) {
+      auto id = promkit::CreateGauge("gauge", "", label(t));
+      return [id, v = 0.0]() mutable { promkit::GaugeSet(id, v += 1); };
+    });
+    scale(std::string("GaugeAdd/atomic/") + sharing, [&](int t) {
+      auto id = promkit::CreateGauge("gauge", "", label(t));
+      return [id] { promkit::GaugeAdd(id, 1); };
+    });
+    for (const char* m : kHistogramModes) {
+      const std::string metric = std::string("histogram_") + m;
+      scale(std::string("HistogramObserve/") + m + "/" + sharing, [&](int t) {
+        auto id = promkit::CreateHistogram(metric, "", {}, label(t));
+        // walks the default latency buckets: 0.1ms..~1.6s
+        return [id, v = 1e-4]() mutable {
+          promkit::HistogramObserve(id, v);
+          v = v > 1 ? 1e-4 : v * 1.3;
+        };
+      });
+      scale(std::string("ScopeTimer/") + m + "/" + sharing, [&](int t) {
+        auto id = promkit::CreateHistogram(metric, "", {}, label(t));
+        return [id] { promkit::ScopeTimer timer(id); };
+      });
+    }
+    scale(std::string("SummaryObserve/sketch/") + sharing, [&](int t) {
+      auto id = promkit::CreateSummary("summary", "", label(t));
+      return [id, v = 1e-4]() mutable {
+        promkit::SummaryObserve(id, v);
+        v = v > 1 ? 1e-4 : v * 1.3;
+      };
+    });
+  }
+
+  // Create* lookups: a TOML-defined metric resolves through its dense table, an
+  // ad-hoc one through the series index (both hit existing series).
+  const std::map<std::string, std::string> adhoc{{"k", "v"}};
+  promkit::CreateCounter("adhoc_counter", "", adhoc);
+  promkit::CreateHistogram("adhoc_histogram", "", {}, adhoc);
+  scale("CreateCounter/toml", [&](int t) {
+    auto labels = series(t);
+    return [labels] { promkit::CreateCounter("counter_atomic", "", labels); };
+  });
+  scale("CreateCounter/adhoc", [&](int) {
+    return [&adhoc] { promkit::CreateCounter("adhoc_counter", "", adhoc); };
+  });
+  scale("CreateHistogram/toml", [&](int t) {
+    auto labels = series(t);
+    return [labels] { promkit::CreateHistogram("histogram_atomic", "", {}, labels); };
+  });
+  scale("CreateHistogram/adhoc", [&](int) {
+    return [&adhoc] { promkit::CreateHistogram("adhoc_histogram", "", {}, adhoc); };
+  });
+
+  promkit::Shutdown();
+  const auto json = Json(o, results);
+  if (o.out.empty()) {
+    std::cout << json;
+  } else {
+    std::ofstream out(o.out);
+    out << json;
+    if (!out) {
+      std::cerr << "cannot write " << o.out << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,346 @@
+// promkit-scrape-bench: /metrics and mux aggregation cost against forked synthetic workers, as JSON
+//
+//   promkit-scrape-bench [--workers N] [--families F] [--series S] [--buckets B]
+//                        [--scrapes K] [--port P] [--transport http|shm] [--out file.json]
+//
+// Forks N workers that each register F families (counter, gauge, histogram and
+// summary in turn) of S series, histograms with B buckets, and keep changing
+// every value; this process is the mux aggregator on 127.0.0.1:P. No family is
+// declared in TOML, so the summaries reach the aggregator in sketch form and
+// must leave it as summaries; the bench fails when one does not. Then, K times each:
+//   parse        ParseTextExposition over the aggregator's /metrics body
+//   mux_collect  MuxCollector::Collect on the workers' directory (fetch, parse, merge)
+//   scrape       GET /metrics from the aggregator over loopback
+// and reports p50/p99 latency, bytes, allocations (operator new in this
+// process) and CPU (this process, user + system) per scrape. Linux/POSIX only.
+#include <promkit/promkit.hpp>
+#include "MergeTable.hpp"
+#include "MuxCollector.hpp"
+#include "TextParser.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Allocation counting for the whole process (the in-process aggregator included).
+static std::atomic<std::uint64_t> g_allocs{0};
+
+void* operator new(std::size_t n) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+struct Options {
+  int workers = 4;
+  int families = 20;
+  int series = 50;
+  int buckets = 10;
+  int scrapes = 50;
+  int port = 19600;
+  std::string transport = "http";
+  std::string out;
+};
+
+struct Result {
+  std::string name;
+  double p50_ms, p99_ms, mean_ms;
+  double bytes;  // per scrape, 0 when the case moves no text
+  double series; // per scrape, 0 when the case does not build families
+  double allocs; // per scrape
+  double cpu_ms; // per scrape
+};
+
+// What one scrape produced.
+struct Sample {
+  std::size_t bytes = 0;
+  std::size_t series = 0;
+};
+
+std::size_t SeriesOf(const std::vector<prometheus::MetricFamily>& fams) {
+  std::size_t n = 0;
+  for (const auto& f : fams) n += f.metric.size();
+  return n;
+}
+
+promkit::Config MuxConfig(const Options& o, const std::string& component) {
+  promkit::Config c;
+  c.mode = "mux";
+  c.host = "127.0.0.1";
+  c.port = o.port;
+  c.prefix = "scrapebench";
+  c.labels = {{"component", component}};
+  c.mux_transport = o.transport;
+  c.gzip_level = 0;
+  return c;
+}
+
+// Worker process: registers the synthetic families, reports ready on `ready`,
+// then updates every series until `stop` reaches EOF.
+[[noreturn]] void RunWorker(const Options& o, int index, int go, int ready, int stop) {
+  char c;
+  if (read(go, &c, 1) != 1 || !promkit::Init(MuxConfig(o, "w" + std::to_string(index)))) _exit(1);
+  std::vector<double> bounds;
+  for (int b = 0; b < o.buckets; ++b) bounds.push_back(0.001 * (1 << std::min(b, 30)));
+  std::vector<promkit::CounterId> counters;
+  std::vector<promkit::GaugeId> gauges;
+  std::vector<promkit::HistogramId> hists;
+  std::vector<promkit::SummaryId> summaries;
+  for (int f = 0; f < o.families; ++f) {
+    const std::string name = "family_" + std::to_string(f);
+    for (int s = 0; s < o.series; ++s) {
+      const std::map<std::string, std::string> labels{{"series", std::to_string(s)}, {"shard", "a"}};
+      switch (f % 4) {
+        case 0: counters.push_back(promkit::CreateCounter(name + "_total", "synthetic counter", labels)); break;
+        case 1: gauges.push_back(promkit::CreateGauge(name, "synthetic gauge", labels)); break;
+        case 2: hists.push_back(promkit::CreateHistogram(name + "_seconds", "synthetic histogram", bounds, labels)); break;
+        case 3: summaries.push_back(promkit::CreateSummary(name + "_latency", "synthetic summary", labels)); break;
+      }
+    }
+  }
+  if (write(ready, "r", 1) != 1) _exit(1);
+  std::atomic<bool> done{false};
+  std::thread churn([&] {
+    for (double v = 0; !done.load(); v += 1) {
+      for (auto id : counters) promkit::CounterAdd(id, 1);
+      for (auto id : gauges) promkit::GaugeSet(id, v);
+      for (auto id : hists) promkit::HistogramObserve(id, 0.0005 * (static_cast<int>(v) % 64));
+      for (auto id : summaries) promkit::SummaryObserve(id, 0.0005 * (static_cast<int>(v) % 64));
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+  while (read(stop, &c, 1) > 0) {}
+  done.store(true);
+  churn.join();
+  promkit::Shutdown();
+  _exit(0);
+}
+
+// GET path from 127.0.0.1:port with Connection: close; the body, or empty on failure.
+std::string HttpGet(int port, const std::string& path) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return {};
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<std::uint16_t>(port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  std::string resp;
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0) {
+    const std::string req = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+    if (send(fd, req.data(), req.size(), 0) == static_cast<ssize_t>(req.size())) {
+      char buf[64 * 1024];
+      for (ssize_t n; (n = recv(fd, buf, sizeof buf, 0)) > 0;) resp.append(buf, static_cast<std::size_t>(n));
+    }
+  }
+  close(fd);
+  const auto body = resp.find("\r\n\r\n");
+  return body == std::string::npos ? std::string{} : resp.substr(body + 4);
+}
+
+double CpuMs() {
+  rusage ru{};
+  getrusage(RUSAGE_SELF, &ru);
+  auto ms = [](const timeval& t) { return t.tv_sec * 1e3 + t.tv_usec / 1e3; };
+  return ms(ru.ru_utime) + ms(ru.ru_stime);
+}
+
+// Runs scrape() o.scrapes times; scrape returns its Sample.
+template <typename Scrape>
+Result Measure(const Options& o, const std::string& name, Scrape&& scrape) {
+  scrape(); // warm up: connections, worker tables, template caches
+  std::vector<double> lat;
+  double bytes = 0, series = 0;
+  const auto allocs0 = g_allocs.load();
+  const double cpu0 = CpuMs();
+  for (int i = 0; i < o.scrapes; ++i) {
+    const auto t0 = std::chrono::steady_clock::now();
+    const Sample sample = scrape();
+    bytes += static_cast<double>(sample.bytes);
+    series += static_cast<double>(sample.series);
+    lat.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+  }
+  const double n = o.scrapes;
+  const double cpu = (CpuMs() - cpu0) / n;
+  const double allocs = static_cast<double>(g_allocs.load() - allocs0) / n;
+  double mean = 0;
+  for (double l : lat) mean += l / n;
+  std::sort(lat.begin(), lat.end());
+  auto pct = [&](double p) { return lat[std::min(lat.size() - 1, static_cast<std::size_t>(p * (lat.size() - 1) + 0.5))]; };
+  Result r{name, pct(0.5), pct(0.99), mean, bytes / n, series / n, allocs, cpu};
+  std::cerr << name << ": p50 " << r.p50_ms << " ms, p99 " << r.p99_ms << " ms, " << r.bytes << " B, " << r.series
+            << " series, " << r.allocs << " allocs, " << r.cpu_ms << " ms cpu\n";
+  return r;
+}
+
+std::string Json(const Options& o, const std::vector<Result>& results) {
+  char date[32];
+  const std::time_t now = std::time(nullptr);
+  std::strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+  std::ostringstream s;
+  s.precision(6);
+  s << "{\n  \"context\": {\"date\": \"" << date << "\", \"workers\": " << o.workers << ", \"families\": " << o.families
+    << ", \"series_per_family\": " << o.series << ", \"buckets\": " << o.buckets << ", \"scrapes\": " << o.scrapes
+    << ", \"transport\": \"" << o.transport << "\"},\n  \"benchmarks\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    s << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"p50_ms\": " << r.p50_ms << ", \"p99_ms\": " << r.p99_ms
+      << ", \"mean_ms\": " << r.mean_ms << ", \"bytes\": " << r.bytes << ", \"series\": " << r.series
+      << ", \"allocs\": " << r.allocs
+      << ", \"cpu_ms\": " << r.cpu_ms << "}";
+  }
+  s << "\n  ]\n}\n";
+  return s.str();
+}
+
+bool ParseArgs(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string a = argv[i];
+    if (i + 1 >= argc) return false;
+    const std::string v = argv[++i];
+    if (a == "--workers") o.workers = std::max(1, std::stoi(v));
+    else if (a == "--families") o.families = std::max(1, std::stoi(v));
+    else if (a == "--series") o.series = std::max(1, std::stoi(v));
+    else if (a == "--buckets") o.buckets = std::max(1, std::stoi(v));
+    else if (a == "--scrapes") o.scrapes = std::max(1, std::stoi(v));
+    else if (a == "--port") o.port = std::stoi(v);
+    else if (a == "--transport") o.transport = v;
+    else if (a == "--out") o.out = v;
+    else return false;
+  }
+  return true;
+}
+
+// Whether every synthetic summary family in fams is a summary with quantiles
+// and without the sketch marker.
+bool SummariesIntact(const Options& o, const std::vector<prometheus::MetricFamily>& fams) {
+  int found = 0;
+  for (const auto& f : fams) {
+    if (!f.name.ends_with("_latency")) continue;
+    ++found;
+    if (f.type != prometheus::MetricType::Summary) return false;
+    for (const auto& m : f.metric) {
+      if (m.summary.quantile.empty()) return false;
+      for (const auto& l : m.label) {
+        if (l.name == promkit::mux::kSketchLabel) return false;
+      }
+    }
+  }
+  return found == o.families / 4;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  try {
+    if (!ParseArgs(argc, argv, o)) {
+      std::cerr << "usage: " << argv[0] << " [--workers N] [--families F] [--series S] [--buckets B] [--scrapes K]"
+                << " [--port P] [--transport http|shm] [--out file]\n";
+      return 2;
+    }
+  } catch (...) {
+    std::cerr << "bad argument value\n";
+    return 2;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  // Workers are forked before this process touches promkit, and Init only
+  // once the aggregator holds the port.
+  int go[2], ready[2], stop[2];
+  if (pipe(go) != 0 || pipe(ready) != 0 || pipe(stop) != 0) return 1;
+  std::vector<pid_t> kids;
+  for (int i = 0; i < o.workers; ++i) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+      close(go[1]);
+      close(ready[0]);
+      close(stop[1]);
+      RunWorker(o, i, go[0], ready[1], stop[0]);
+    }
+    if (pid > 0) kids.push_back(pid);
+  }
+  close(go[0]);
+  close(ready[1]);
+  close(stop[0]);
+  auto finish = [&](int rc) {
+    close(stop[1]);
+    for (auto pid : kids) waitpid(pid, nullptr, 0);
+    promkit::Shutdown();
+    return rc;
+  };
+
+  if (!promkit::Init(MuxConfig(o, "agg"))) {
+    std::cerr << "cannot become the aggregator on port " << o.port << "\n";
+    close(go[1]);
+    return finish(1);
+  }
+  const std::string go_bytes(kids.size(), 'g');
+  if (write(go[1], go_bytes.data(), go_bytes.size()) != static_cast<ssize_t>(go_bytes.size())) return finish(1);
+  close(go[1]);
+  char c;
+  for (std::size_t i = 0; i < kids.size(); ++i) {
+    if (read(ready[0], &c, 1) != 1) {
+      std::cerr << "a worker failed to start\n";
+      return finish(1);
+    }
+  }
+  // Let shm workers publish their first segment.
+  std::this_thread::sleep_for(std::chrono::milliseconds(o.transport == "shm" ? 300 : 50));
+
+  std::error_code ec;
+  const auto dir = (std::filesystem::temp_directory_path(ec) / "promkit-mux" / "scrapebench").string();
+  promkit::mux::MuxCollector mux;
+  mux.SetDirectory(dir);
+
+  std::vector<Result> results;
+  const std::string body = HttpGet(o.port, "/metrics");
+  if (!SummariesIntact(o, promkit::mux::ParseTextExposition(body))) {
+    std::cerr << "summaries did not come through the aggregator as summaries\n";
+    return finish(1);
+  }
+  results.push_back(Measure(o, "parse", [&] {
+    return Sample{body.size(), SeriesOf(promkit::mux::ParseTextExposition(body))};
+  }));
+  results.push_back(Measure(o, "mux_collect", [&] { return Sample{0, SeriesOf(mux.Collect())}; }));
+  results.push_back(Measure(o, "scrape", [&] { return Sample{HttpGet(o.port, "/metrics").size(), 0}; }));
+
+  const auto json = Json(o, results);
+  if (o.out.empty()) {
+    std::cout << json;
+  } else {
+    std::ofstream out(o.out);
+    out << json;
+    if (!out) {
+      std::cerr << "cannot write " << o.out << "\n";
+      return finish(1);
+    }
+  }
+  return finish(0);
+}
@@ -8,7 +8,7 @@ namespace promkit {
 
 struct MetricDef {
   std::string name;
-  std::string type;       // counter|gauge|histogram
+  std::string type;       // counter|gauge|histogram|summary
   std::string help;
   std::string unit;       // annotation only
   std::map<std::string, std::string> const_labels;
@@ -16,6 +16,14 @@ struct MetricDef {
   std::string buckets_profile; // for histograms
   std::string publish;    // sum_only|per_proc|both (default inherited)
   std::string gauge_agg;  // sum|last|max (gauge only)
+  std::string counter_mode; // atomic|sharded|local (counter only; default from exporter)
+  std::string histogram_mode; // atomic|sharded|native (histogram only; default from exporter)
+  int         native_schema = 3;          // native: 2^schema buckets per power of two, -4..8
+  double      native_zero_threshold = 0;  // native: |v| at or below counts as zero; 0: 2^-128
+  std::vector<double> quantiles{0.5, 0.9, 0.99, 0.999}; // summary: exposed quantiles
+  double      relative_accuracy = 0.01;   // summary: bound on a quantile's relative error
+  double      max_age_seconds = 60;       // summary: quantiles cover this sliding window
+  int         age_buckets = 5;            // summary: the window slides in max_age/age_buckets steps
 };
 
 struct FileConfig {
@@ -26,6 +34,16 @@ struct FileConfig {
   int         port    = 9464;
   std::string path    = "/metrics";
   std::string ns;                 // namespace/prefix
+  std::string counter_mode = "atomic"; // default for counters: atomic|sharded|local
+  std::string histogram_mode = "atomic"; // default for histograms: atomic|sharded
+  std::string timer_clock = "steady";    // ScopeTimer tick source: steady|tsc
+  std::string mux_transport = "http";    // mux worker -> aggregator: http|shm
+  int         mux_publish_ms = 1000;     // unused: shm workers publish on request
+  int         mux_worker_timeout_ms = 2000; // aggregator: per-worker fetch deadline
+  int         mux_scrape_budget_ms = 8000;  // aggregator: all workers, keep below scrape_timeout
+  int         scrape_cache_ms = 0;          // serve the last response to scrapes within this window
+  int         gzip_level = 6;               // /metrics gzip level for clients that accept it; 0: off
+  bool        self_metrics = false;         // export promkit's own scrape/series/reject metrics
 
   // labels
   std::map<std::string, std::string> labels; // service/component/env/version/instance/proc
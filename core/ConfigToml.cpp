@@ -22,6 +22,12 @@ static inline int as_int_or(const toml::node_view<toml::node>& nv, int def) {
   return def;
 }
 
+static inline double as_double_or(const toml::node_view<toml::node>& nv, double def) {
+  if (!nv) return def;
+  if (auto v = nv.value<double>()) return *v;
+  return def;
+}
+
 static inline bool as_bool_or(const toml::node_view<toml::node>& nv, bool def) {
   if (!nv) return def;
   if (auto v = nv.value<bool>()) return *v;
@@ -40,6 +46,16 @@ bool ParseConfigToml(const std::string& path, FileConfig& out, std::string& err)
       out.port    = as_int_or(exporter["port"], 9464);
       out.path    = as_string_or(exporter["path"], "/metrics");
       out.ns      = as_string_or(exporter["namespace"], "");
+      out.counter_mode = as_string_or(exporter["counter_mode"], "atomic");
+      out.histogram_mode = as_string_or(exporter["histogram_mode"], "atomic");
+      out.timer_clock = as_string_or(exporter["timer_clock"], "steady");
+      out.mux_transport = as_string_or(exporter["mux_transport"], "http");
+      out.mux_publish_ms = as_int_or(exporter["mux_publish_ms"], 1000);
+      out.mux_worker_timeout_ms = as_int_or(exporter["mux_worker_timeout_ms"], 2000);
+      out.mux_scrape_budget_ms = as_int_or(exporter["mux_scrape_budget_ms"], 8000);
+      out.scrape_cache_ms = as_int_or(exporter["scrape_cache_ms"], 0);
+      out.gzip_level = as_int_or(exporter["gzip_level"], 6);
+      out.self_metrics = as_bool_or(exporter["self_metrics"], false);
     }
 
     // labels
@@ -76,6 +92,19 @@ bool ParseConfigToml(const std::string& path, FileConfig& out, std::string& err)
         def.buckets_profile = as_string_or(mt["buckets_profile"], "");
         def.publish = as_string_or(mt["publish"], "");
         def.gauge_agg = as_string_or(mt["gauge_agg"], "");
+        def.counter_mode = as_string_or(mt["counter_mode"], "");
+        def.histogram_mode = as_string_or(mt["histogram_mode"], "");
+        def.native_schema = as_int_or(mt["native_schema"], 3);
+        def.native_zero_threshold = as_double_or(mt["native_zero_threshold"], 0);
+        def.relative_accuracy = as_double_or(mt["relative_accuracy"], 0.01);
+        def.max_age_seconds = as_double_or(mt["max_age_seconds"], 60);
+        def.age_buckets = as_int_or(mt["age_buckets"], 5);
+        if (auto qs = mt["quantiles"].as_array()) {
+          def.quantiles.clear();
+          for (auto&& el : *qs) {
+            if (auto q = el.value<double>(); q && *q >= 0 && *q <= 1) def.quantiles.push_back(*q);
+          }
+        }
 
         if (auto cl = mt["const_labels"]; cl.is_table()) {
           for (auto&& [k,v] : *cl.as_table()) {
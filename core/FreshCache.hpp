@@ -0,0 +1,71 @@
+// Single-flight cache of an expensive result with a freshness window
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace promkit {
+
+// Get returns the last result while it is younger than the window (measured
+// from when its computation started) and computes a new one otherwise.
+// Callers arriving while a computation is in flight wait for it and share its
+// result, whatever the window, so concurrent scrapes cost one computation.
+template <typename T>
+class FreshCache {
+ public:
+  void SetWindow(std::chrono::milliseconds window) {
+    std::lock_guard<std::mutex> lk(mu_);
+    window_ = window;
+  }
+
+  template <typename Compute>
+  std::shared_ptr<const T> Get(Compute&& compute) {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (true) {
+      const auto now = std::chrono::steady_clock::now();
+      if (value_ && now - stamp_ < window_) return value_;
+      if (!computing_) break;
+      const auto gen = gen_;
+      cv_.wait(lk, [&] { return gen_ != gen; });
+      if (value_ && ok_) return value_; // shared the flight we waited for; else it failed: try ourselves
+    }
+    computing_ = true;
+    const auto start = std::chrono::steady_clock::now();
+    lk.unlock();
+    std::shared_ptr<const T> v;
+    try {
+      v = std::make_shared<const T>(compute());
+    } catch (...) {
+      lk.lock();
+      Finish(false);
+      throw;
+    }
+    lk.lock();
+    value_ = std::move(v);
+    stamp_ = start;
+    Finish(true);
+    return value_;
+  }
+
+ private:
+  void Finish(bool ok) {
+    computing_ = false;
+    ok_ = ok;
+    ++gen_;
+    cv_.notify_all();
+  }
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::chrono::milliseconds window_{0};
+  std::shared_ptr<const T> value_;
+  std::chrono::steady_clock::time_point stamp_;
+  bool computing_ = false;
+  bool ok_ = false;       // outcome of the last computation
+  std::uint64_t gen_ = 0; // completed computations
+};
+
+} // namespace promkit
@@ -0,0 +1,77 @@
+// Thread-local counter accumulation: thread registration and collect-side sums
+#include "LocalCounters.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+
+namespace promkit {
+
+namespace {
+
+// Guards row registration, thread exit, block destruction and Sum. Leaked so
+// thread_local destructors running late at process exit can still lock it.
+std::mutex& RegistryMu() {
+  static auto* mu = new std::mutex;
+  return *mu;
+}
+
+// Ids are never reused, so a stale row of a destroyed block is never mistaken
+// for a row of a new one.
+std::atomic<std::size_t> g_next_id{0};
+
+} // namespace
+
+namespace detail {
+
+LocalRows::~LocalRows() {
+  std::lock_guard<std::mutex> lk(RegistryMu());
+  for (auto* row : by_id) {
+    if (!row) continue;
+    if (auto* owner = row->owner) {
+      for (std::size_t i = 0; i < owner->columns_; ++i) {
+        owner->retired_[i] += row->cells[i].value.load(std::memory_order_relaxed);
+      }
+      std::erase(owner->rows_, row);
+    }
+    delete row;
+  }
+  by_id.clear();
+}
+
+} // namespace detail
+
+LocalCounters::LocalCounters(std::size_t columns)
+    : id_(g_next_id.fetch_add(1, std::memory_order_relaxed)),
+      columns_(columns),
+      retired_(std::make_unique<double[]>(columns ? columns : 1)) {}
+
+LocalCounters::~LocalCounters() {
+  // Rows stay owned by their threads (freed at thread exit); just detach them.
+  std::lock_guard<std::mutex> lk(RegistryMu());
+  for (auto* row : rows_) row->owner = nullptr;
+}
+
+detail::LocalRow* LocalCounters::Join() noexcept {
+  try {
+    auto row = std::make_unique<detail::LocalRow>();
+    row->owner = this;
+    row->cells = std::make_unique<detail::LocalCell[]>(columns_ ? columns_ : 1);
+    auto& rows = detail::t_local_rows.by_id;
+    if (rows.size() <= id_) rows.resize(id_ + 1, nullptr);
+    std::lock_guard<std::mutex> lk(RegistryMu());
+    rows_.push_back(row.get());
+    return rows[id_] = row.release();
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+double LocalCounters::Sum(std::size_t col) const noexcept {
+  std::lock_guard<std::mutex> lk(RegistryMu());
+  double sum = retired_[col];
+  for (const auto* row : rows_) sum += row->cells[col].value.load(std::memory_order_relaxed);
+  return sum;
+}
+
+} // namespace promkit
@@ -0,0 +1,70 @@
+// Thread-local counter accumulation, readable by collectors at any time
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace promkit {
+
+class LocalCounters;
+
+namespace detail {
+// One thread's accumulator for one series. Only the owning thread stores it,
+// so an add is a relaxed load and store (no RMW); collectors load it.
+struct LocalCell {
+  std::atomic<double> value{0.0};
+};
+
+// One thread's cells for one LocalCounters block.
+struct LocalRow {
+  LocalCounters* owner = nullptr; // null once the block is destroyed (under the registry lock)
+  std::unique_ptr<LocalCell[]> cells;
+};
+
+// The calling thread's rows, indexed by LocalCounters id. The destructor hands
+// the values to their blocks when the thread exits.
+struct LocalRows {
+  std::vector<LocalRow*> by_id;
+  ~LocalRows();
+};
+inline thread_local LocalRows t_local_rows;
+} // namespace detail
+
+// Counters of one metric accumulated in per-thread rows allocated on a thread's
+// first add, so any number of threads write without contention. Sum reads the
+// cells of live threads plus what exited threads left behind, so a collect
+// sees each thread's running total, not a periodically published one.
+class LocalCounters {
+ public:
+  explicit LocalCounters(std::size_t columns);
+  ~LocalCounters();
+  LocalCounters(const LocalCounters&) = delete;
+  LocalCounters& operator=(const LocalCounters&) = delete;
+
+  void Add(std::size_t col, double v) noexcept {
+    auto& rows = detail::t_local_rows.by_id;
+    detail::LocalRow* row = id_ < rows.size() ? rows[id_] : nullptr;
+    if (!row && !(row = Join())) return;
+    auto& c = row->cells[col].value;
+    c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  }
+
+  double Sum(std::size_t col) const noexcept;
+  std::size_t Columns() const noexcept { return columns_; }
+
+ private:
+  friend struct detail::LocalRows;
+
+  // Registers the calling thread's row for this block; null on allocation failure.
+  detail::LocalRow* Join() noexcept;
+
+  std::size_t id_ = 0;
+  std::size_t columns_ = 0;
+  // Under the registry lock:
+  std::vector<detail::LocalRow*> rows_;
+  std::unique_ptr<double[]> retired_; // per column, from exited threads
+};
+
+} // namespace promkit
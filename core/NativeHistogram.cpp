@@ -0,0 +1,177 @@
+#include "NativeHistogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <new>
+
+namespace promkit {
+
+namespace {
+
+constexpr std::uint64_t kMantissaMask = (1ull << 52) - 1;
+
+// For schema s > 0 (n = 2^s buckets per power of two): the bounds 2^(j/n - 1)
+// in [0.5, 1) that frexp fractions are compared against, and for each of the
+// 2n cells of the top s+1 mantissa bits the first bound at or above the cell's
+// start. A cell is narrower than any two bounds are apart, so the bucket is
+// its first bound or the next one (bounds end with a 1.0 sentinel).
+struct SchemaTables {
+  std::vector<double> bounds[kNativeMaxSchema + 1];
+  std::vector<std::uint16_t> first[kNativeMaxSchema + 1];
+
+  SchemaTables() {
+    for (int s = 1; s <= kNativeMaxSchema; ++s) {
+      const int n = 1 << s;
+      auto& b = bounds[s];
+      for (int j = 0; j < n; ++j) b.push_back(std::exp2(static_cast<double>(j) / n - 1));
+      b.push_back(1.0);
+      for (int cell = 0; cell < 2 * n; ++cell) {
+        const double start = 0.5 * (1 + static_cast<double>(cell) / (2 * n));
+        first[s].push_back(static_cast<std::uint16_t>(std::lower_bound(b.begin(), b.begin() + n, start) - b.begin()));
+      }
+    }
+  }
+};
+
+const SchemaTables& Tables() {
+  static const SchemaTables t;
+  return t;
+}
+
+} // namespace
+
+int NativeBucketIndex(double v, int schema) noexcept {
+  const auto bits = std::bit_cast<std::uint64_t>(v);
+  const int biased = static_cast<int>((bits >> 52) & 0x7ff);
+  int exp;        // frexp exponent: v = frac * 2^exp, frac in [0.5, 1)
+  double frac;
+  std::uint64_t mant;
+  if (biased != 0) {
+    exp = biased - 1022;
+    mant = bits & kMantissaMask;
+    frac = std::bit_cast<double>(mant | (1022ull << 52));
+  } else { // subnormal
+    frac = std::frexp(v, &exp);
+    mant = std::bit_cast<std::uint64_t>(frac) & kMantissaMask;
+  }
+  if (schema <= 0) {
+    const int key = mant == 0 ? exp - 1 : exp; // a power of two closes the bucket below it
+    const int offset = (1 << -schema) - 1;
+    return (key + offset) >> -schema;
+  }
+  const auto& t = Tables();
+  const int first = t.first[schema][mant >> (52 - (schema + 1))];
+  const int j = first + (t.bounds[schema][first] < frac ? 1 : 0);
+  return ((exp - 1) << schema) + j;
+}
+
+double NativeUpperBound(int index, int schema) noexcept {
+  if (schema <= 0) return std::ldexp(1.0, index * (1 << -schema));
+  const int n = 1 << schema;
+  return std::ldexp(Tables().bounds[schema][index & (n - 1)], (index >> schema) + 1);
+}
+
+int NativeIndexOfBound(double bound, int schema) noexcept {
+  if (schema <= 0) return static_cast<int>(std::lround(std::log2(bound))) >> -schema;
+  return static_cast<int>(std::lround(std::log2(bound) * (1 << schema)));
+}
+
+NativeHistogram::NativeHistogram(int schema, double zero_threshold)
+    : schema_(std::clamp(schema, kNativeMinSchema, kNativeMaxSchema)),
+      zero_threshold_(zero_threshold > 0 ? zero_threshold : kNativeDefaultZeroThreshold),
+      block_shift_(std::max(schema_, 0)) {
+  if (schema_ >= 0) {
+    min_index_ = -kOctaves << schema_;
+    max_index_ = ((kOctaves + 1) << schema_) - 1;
+  } else {
+    min_index_ = -kOctaves >> -schema_;
+    max_index_ = kOctaves >> -schema_;
+  }
+}
+
+NativeHistogram::~NativeHistogram() {
+  for (auto& side : blocks_) {
+    for (auto& b : side) delete[] b.load(std::memory_order_relaxed);
+  }
+}
+
+std::atomic<std::uint64_t>* NativeHistogram::Cell(int sign, int index) noexcept {
+  auto& block = blocks_[sign][(index >> block_shift_) + kOctaves];
+  auto* cells = block.load(std::memory_order_acquire);
+  if (!cells) {
+    auto* fresh = new (std::nothrow) std::atomic<std::uint64_t>[std::size_t{1} << block_shift_]();
+    if (!fresh) return nullptr;
+    if (block.compare_exchange_strong(cells, fresh, std::memory_order_acq_rel)) cells = fresh;
+    else delete[] fresh; // another thread installed one first
+  }
+  return &cells[index & ((1 << block_shift_) - 1)];
+}
+
+void NativeHistogram::Observe(double v) noexcept {
+  sum_.fetch_add(v, std::memory_order_relaxed);
+  ObserveBucket(v);
+}
+
+void NativeHistogram::ObserveBucket(double v) noexcept {
+  if (std::isnan(v)) {
+    nan_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  const double a = std::fabs(v);
+  if (a <= zero_threshold_) {
+    zero_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  const int index = std::isinf(a) ? max_index_ : std::clamp(NativeBucketIndex(a, schema_), min_index_, max_index_);
+  if (auto* c = Cell(v < 0 ? 1 : 0, index)) c->fetch_add(1, std::memory_order_relaxed);
+}
+
+void NativeHistogram::Reset() noexcept {
+  sum_.store(0.0, std::memory_order_relaxed);
+  zero_.store(0, std::memory_order_relaxed);
+  nan_.store(0, std::memory_order_relaxed);
+  const int per_block = 1 << block_shift_;
+  for (auto& side : blocks_) {
+    for (auto& b : side) {
+      auto* cells = b.load(std::memory_order_acquire);
+      if (!cells) continue;
+      for (int i = 0; i < per_block; ++i) cells[i].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+void NativeHistogram::Collect(Snapshot& out) const {
+  out.sum = sum_.load(std::memory_order_relaxed);
+  out.zero_count = zero_.load(std::memory_order_relaxed);
+  out.count = out.zero_count + nan_.load(std::memory_order_relaxed);
+  out.positive.clear();
+  out.negative.clear();
+  const int per_block = 1 << block_shift_;
+  for (int sign = 0; sign < 2; ++sign) {
+    auto& dst = sign ? out.negative : out.positive;
+    for (int b = 0; b < kBlocks; ++b) {
+      const auto* cells = blocks_[sign][b].load(std::memory_order_acquire);
+      if (!cells) continue;
+      for (int i = 0; i < per_block; ++i) {
+        if (const auto c = cells[i].load(std::memory_order_relaxed)) {
+          dst.emplace_back((b - kOctaves) * per_block + i, c);
+          out.count += c;
+        }
+      }
+    }
+  }
+}
+
+void NativeBuckets(const NativeHistogram::Snapshot& snap, int schema, double zero_threshold,
+                   std::vector<std::pair<double, std::uint64_t>>& out) {
+  out.clear();
+  // a negative bucket's upper bound is the negated lower bound of its magnitude
+  for (auto it = snap.negative.rbegin(); it != snap.negative.rend(); ++it) {
+    out.emplace_back(-NativeUpperBound(it->first - 1, schema), it->second);
+  }
+  if (snap.zero_count != 0 || !snap.negative.empty()) out.emplace_back(zero_threshold, snap.zero_count);
+  for (const auto& [index, c] : snap.positive) out.emplace_back(NativeUpperBound(index, schema), c);
+}
+
+} // namespace promkit
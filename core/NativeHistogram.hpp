@@ -0,0 +1,85 @@
+// Sparse exponential (native) histograms
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace promkit {
+
+// Prometheus native histogram schemas: 2^schema buckets per power of two.
+inline constexpr int kNativeMinSchema = -4;
+inline constexpr int kNativeMaxSchema = 8;
+inline constexpr double kNativeDefaultZeroThreshold = 0x1p-128;
+
+struct NativeSchema {
+  int schema = 3;
+  double zero_threshold = kNativeDefaultZeroThreshold;
+};
+// Native histogram families by full name.
+using NativeSchemas = std::unordered_map<std::string, NativeSchema>;
+
+// Bucket of a finite v > 0 under schema: bucket i holds (2^((i-1)/2^s), 2^(i/2^s)].
+// Read off the exponent bits, plus for schema > 0 a table lookup on the top
+// mantissa bits and at most two compares.
+int NativeBucketIndex(double v, int schema) noexcept;
+// 2^(index / 2^schema), the upper bound of bucket index.
+double NativeUpperBound(int index, int schema) noexcept;
+// Inverse of NativeUpperBound for a bound it produced.
+int NativeIndexOfBound(double bound, int schema) noexcept;
+
+// One native histogram series. Buckets live in per-power-of-two blocks that
+// are allocated on first use (covering 2^-128..2^128; values beyond clamp to
+// the end buckets), so an Observe is an index computation and two relaxed
+// atomic adds (bucket and sum). |v| <= zero_threshold counts in the zero bucket; NaN only in count/sum.
+class NativeHistogram {
+ public:
+  NativeHistogram(int schema, double zero_threshold);
+  ~NativeHistogram();
+  NativeHistogram(const NativeHistogram&) = delete;
+  NativeHistogram& operator=(const NativeHistogram&) = delete;
+
+  void Observe(double v) noexcept;
+  // Counts v in its bucket only, leaving the sum alone.
+  void ObserveBucket(double v) noexcept;
+  // Zeroes every count and the sum; observations racing with it may survive.
+  void Reset() noexcept;
+
+  struct Snapshot {
+    std::uint64_t count = 0;
+    double sum = 0;
+    std::uint64_t zero_count = 0;
+    // (bucket index, count) of non-empty buckets, ascending index
+    std::vector<std::pair<int, std::uint64_t>> positive;
+    std::vector<std::pair<int, std::uint64_t>> negative;
+  };
+  void Collect(Snapshot& out) const;
+
+  int schema() const noexcept { return schema_; }
+  double zero_threshold() const noexcept { return zero_threshold_; }
+
+ private:
+  static constexpr int kOctaves = 128; // blocks cover octaves [-kOctaves, kOctaves]
+  static constexpr int kBlocks = 2 * kOctaves + 1;
+
+  std::atomic<std::uint64_t>* Cell(int sign, int index) noexcept; // null if the block cannot be allocated
+
+  int schema_;
+  double zero_threshold_;
+  int block_shift_;            // log2(buckets per block): max(schema, 0)
+  int min_index_, max_index_;  // clamp range
+  std::atomic<double> sum_{0.0};
+  std::atomic<std::uint64_t> zero_{0};
+  std::atomic<std::uint64_t> nan_{0}; // count is these plus the buckets
+  std::atomic<std::atomic<std::uint64_t>*> blocks_[2][kBlocks] = {}; // [negative?][block]
+};
+
+// Non-empty buckets of snap as (upper bound, count), ascending: negative
+// buckets, the zero bucket (bound zero_threshold; present when it or any
+// negative bucket is non-empty), positive buckets.
+void NativeBuckets(const NativeHistogram::Snapshot& snap, int schema, double zero_threshold,
+                   std::vector<std::pair<double, std::uint64_t>>& out);
+
+} // namespace promkit
@@ -0,0 +1,120 @@
+#include "QuantileSketch.hpp"
+
+#include <promkit/promkit.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <new>
+
+namespace promkit {
+
+int SketchSchema(double relative_accuracy) noexcept {
+  for (int s = kNativeMinSchema; s < kNativeMaxSchema; ++s) {
+    const double gamma = std::exp2(std::exp2(-s));
+    if ((gamma - 1) / (gamma + 1) <= relative_accuracy) return s;
+  }
+  return kNativeMaxSchema;
+}
+
+double SketchQuantile(const std::vector<std::pair<double, std::uint64_t>>& buckets, double q, int schema) noexcept {
+  std::uint64_t n = 0;
+  for (const auto& b : buckets) n += b.second;
+  if (n == 0) return std::numeric_limits<double>::quiet_NaN();
+  const double rank = std::clamp(q, 0.0, 1.0) * static_cast<double>(n - 1);
+  const double gamma = std::exp2(std::exp2(-schema));
+  std::uint64_t cum = 0;
+  for (const auto& [bound, c] : buckets) {
+    cum += c;
+    if (static_cast<double>(cum) <= rank) continue;
+    if (bound < 0) return bound * 2 * gamma / (gamma + 1); // magnitudes (|bound|, |bound| * gamma]
+    if (bound <= kNativeDefaultZeroThreshold) return 0;
+    return bound * 2 / (gamma + 1);
+  }
+  return buckets.back().first;
+}
+
+QuantileSketch::QuantileSketch(int schema, double max_age_seconds, int age_buckets)
+    : schema_(std::clamp(schema, kNativeMinSchema, kNativeMaxSchema)), age_buckets_(std::max(age_buckets, 1)) {
+  const double period = std::max(max_age_seconds, 0.001) / age_buckets_;
+  period_ticks_ = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(period / SecondsPerTick()));
+  auto* first = NewStripe();
+  if (!first) throw std::bad_alloc();
+  stripes_[0].store(first, std::memory_order_relaxed);
+}
+
+QuantileSketch::~QuantileSketch() {
+  for (auto& st : stripes_) delete st.load(std::memory_order_relaxed);
+}
+
+QuantileSketch::Stripe* QuantileSketch::NewStripe() const {
+  try {
+    auto st = std::make_unique<Stripe>();
+    st->epochs = std::make_unique<std::atomic<std::uint64_t>[]>(age_buckets_);
+    for (int i = 0; i < age_buckets_; ++i) {
+      st->windows.push_back(std::make_unique<NativeHistogram>(schema_, kNativeDefaultZeroThreshold));
+      st->epochs[i].store(kNoEpoch, std::memory_order_relaxed);
+    }
+    return st.release();
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+QuantileSketch::Stripe* QuantileSketch::StripeFor(std::uint32_t shard) noexcept {
+  auto& slot = stripes_[shard % kStripes];
+  if (auto* st = slot.load(std::memory_order_acquire)) return st;
+  std::lock_guard<std::mutex> lk(mu_);
+  auto* st = slot.load(std::memory_order_relaxed);
+  if (!st) {
+    st = NewStripe();
+    if (!st) return stripes_[0].load(std::memory_order_relaxed); // share the first one
+    slot.store(st, std::memory_order_release);
+  }
+  return st;
+}
+
+void QuantileSketch::Rotate(Stripe& st, std::size_t slot, std::uint64_t epoch) noexcept {
+  std::lock_guard<std::mutex> lk(mu_);
+  const auto seen = st.epochs[slot].load(std::memory_order_relaxed);
+  if (seen != kNoEpoch && seen >= epoch) return; // another thread got here first
+  st.windows[slot]->Reset();
+  st.epochs[slot].store(epoch, std::memory_order_release);
+}
+
+void QuantileSketch::Observe(double v) noexcept {
+  const auto shard = CurrentShard();
+  totals_.AddOn(shard, 0, 1);
+  totals_.AddOn(shard, 1, v);
+  auto& st = *StripeFor(shard);
+  const std::uint64_t epoch = ReadTicks() / period_ticks_;
+  const std::size_t slot = epoch % st.windows.size();
+  if (st.epochs[slot].load(std::memory_order_acquire) != epoch) Rotate(st, slot, epoch);
+  st.windows[slot]->ObserveBucket(v);
+}
+
+void QuantileSketch::Collect(Snapshot& out) const {
+  out.count = static_cast<std::uint64_t>(totals_.Sum(0));
+  out.sum = totals_.Sum(1);
+  const std::uint64_t now = ReadTicks() / period_ticks_;
+  NativeHistogram::Snapshot merged, snap;
+  std::map<int, std::uint64_t> positive, negative;
+  for (const auto& slot : stripes_) {
+    const auto* st = slot.load(std::memory_order_acquire);
+    if (!st) continue;
+    for (std::size_t i = 0; i < st->windows.size(); ++i) {
+      const auto epoch = st->epochs[i].load(std::memory_order_acquire);
+      if (epoch == kNoEpoch || epoch > now || now - epoch >= st->windows.size()) continue;
+      st->windows[i]->Collect(snap);
+      merged.zero_count += snap.zero_count;
+      for (const auto& [index, c] : snap.positive) positive[index] += c;
+      for (const auto& [index, c] : snap.negative) negative[index] += c;
+    }
+  }
+  merged.positive.assign(positive.begin(), positive.end());
+  merged.negative.assign(negative.begin(), negative.end());
+  NativeBuckets(merged, schema_, kNativeDefaultZeroThreshold, out.window);
+}
+
+} // namespace promkit
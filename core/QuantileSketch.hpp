@@ -0,0 +1,77 @@
+// Mergeable quantile sketches for summaries
+#pragma once
+#include "NativeHistogram.hpp"
+#include "Shard.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace promkit {
+
+// DDSketch over the native histogram buckets: with gamma = 2^(2^-schema), the
+// representative 2b/(gamma+1) of a bucket with upper bound b is within
+// (gamma-1)/(gamma+1) of any value in the bucket. Sketches of the same schema
+// merge by adding counts per bound, exactly.
+
+// Smallest schema whose relative error is at most relative_accuracy (the
+// finest, 8, when none is).
+int SketchSchema(double relative_accuracy) noexcept;
+
+// Quantile q of the values counted in buckets, (upper bound, count) ascending
+// as NativeBuckets lists them with the default zero threshold: the
+// representative of the bucket holding rank q*(n-1). NaN when buckets are empty.
+double SketchQuantile(const std::vector<std::pair<double, std::uint64_t>>& buckets, double q, int schema) noexcept;
+
+// One summary series: count and sum since creation, and quantiles over a
+// sliding window of max_age split into age_buckets sub-windows. Count and sum
+// sit in per-thread ShardedCounters slots. The sub-windows are striped: a
+// thread counts into the stripe of its shard slot (allocated on its first
+// Observe; stripe 0 up front), so threads recording the same values do not
+// add to the same bucket cells. Each sub-window of a stripe is a
+// NativeHistogram reused in turn; an Observe checks its sub-window's epoch
+// and, when that is stale, resets it (under a mutex, once per sub-window
+// period and stripe), then adds to one bucket. Collect merges every stripe.
+class QuantileSketch {
+ public:
+  QuantileSketch(int schema, double max_age_seconds, int age_buckets);
+  ~QuantileSketch();
+  QuantileSketch(const QuantileSketch&) = delete;
+  QuantileSketch& operator=(const QuantileSketch&) = delete;
+
+  void Observe(double v) noexcept;
+
+  struct Snapshot {
+    std::uint64_t count = 0; // since creation
+    double sum = 0;
+    std::vector<std::pair<double, std::uint64_t>> window; // NativeBuckets of the live sub-windows
+  };
+  void Collect(Snapshot& out) const;
+
+  int schema() const noexcept { return schema_; }
+
+ private:
+  static constexpr std::uint64_t kNoEpoch = ~std::uint64_t{0};
+  static constexpr std::uint32_t kStripes = 8;
+
+  struct Stripe {
+    std::vector<std::unique_ptr<NativeHistogram>> windows;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> epochs; // per window: ReadTicks() / period_ticks_ it counts
+  };
+
+  Stripe* NewStripe() const; // null when out of memory
+  Stripe* StripeFor(std::uint32_t shard) noexcept;
+  void Rotate(Stripe& st, std::size_t slot, std::uint64_t epoch) noexcept;
+
+  int schema_;
+  int age_buckets_;
+  std::uint64_t period_ticks_; // sub-window length in ticks of ReadTicks
+  std::atomic<Stripe*> stripes_[kStripes] = {};
+  std::mutex mu_; // rotations and stripe allocation
+  ShardedCounters totals_{2}; // columns: count, sum
+};
+
+} // namespace promkit
@@ -0,0 +1,68 @@
+// Read-mostly hashed index
+#include "SeriesIndex.hpp"
+
+#include <thread>
+
+namespace promkit {
+
+namespace {
+constexpr std::size_t kInitialCapacity = 64; // power of two
+} // namespace
+
+SeriesIndex::Table::Table(std::size_t cap) : mask(cap - 1), slots(new std::atomic<const Entry*>[cap]()) {}
+
+SeriesIndex::SeriesIndex() {
+  tables_.push_back(std::make_unique<Table>(kInitialCapacity));
+  table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+SeriesIndex::~SeriesIndex() = default;
+
+void SeriesIndex::Place(Table& t, const Entry* e) noexcept {
+  std::size_t i = e->hash & t.mask;
+  while (t.slots[i].load(std::memory_order_relaxed)) i = (i + 1) & t.mask;
+  t.slots[i].store(e, std::memory_order_release);
+}
+
+std::uint64_t SeriesIndex::Insert(std::string key, std::uint64_t value) {
+  std::lock_guard<std::mutex> lk(mu_);
+  const auto hash = HashBytes(kHashSeed, key);
+  if (auto v = Find(hash, [&](std::string_view k) { return k == key; })) return v;
+
+  auto e = std::make_unique<Entry>(Entry{hash, std::move(key), value});
+  Table* cur = tables_.back().get();
+  // Keep the load factor <= 1/2 so probe chains stay short.
+  if ((entries_.size() + 1) * 2 > cur->mask + 1) {
+    auto bigger = std::make_unique<Table>((cur->mask + 1) * 2);
+    for (const auto& old : entries_) Place(*bigger, old.get());
+    tables_.push_back(std::move(bigger));
+    cur = tables_.back().get();
+    // fully populated before readers can see it
+    table_.store(cur, std::memory_order_release);
+  }
+  Place(*cur, e.get());
+  entries_.push_back(std::move(e));
+  return value;
+}
+
+void SeriesIndex::Clear() {
+  std::lock_guard<std::mutex> lk(mu_);
+  auto fresh = std::make_unique<Table>(kInitialCapacity);
+  table_.store(fresh.get(), std::memory_order_release);
+  tables_.clear();
+  tables_.push_back(std::move(fresh));
+  entries_.clear();
+}
+
+std::size_t SeriesIndex::Size() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return entries_.size();
+}
+
+void ReaderGate::Wait() const noexcept {
+  for (const auto& c : counts_) {
+    while (c.n.load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+  }
+}
+
+} // namespace promkit
@@ -0,0 +1,107 @@
+// Read-mostly hashed index: lock-free lookups, serialized inserts
+#pragma once
+#include "Shard.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace promkit {
+
+// FNV-1a over a key that may be fed in pieces; HashBytes(HashBytes(kHashSeed, "ab"), "c")
+// equals HashBytes(kHashSeed, "abc").
+inline constexpr std::uint64_t kHashSeed = 14695981039346656037ull;
+inline std::uint64_t HashBytes(std::uint64_t h, std::string_view s) noexcept {
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+// Open-addressing table of key -> uint64 value. Entries are immutable once
+// published and never removed before Clear(); growth copies into a new table
+// and publishes it atomically, keeping retired tables alive until Clear().
+// A lookup therefore never locks or allocates. A miss may be stale while an
+// insert is in flight, so callers recheck under their own lock before creating.
+class SeriesIndex {
+ public:
+  SeriesIndex();
+  ~SeriesIndex();
+  SeriesIndex(const SeriesIndex&) = delete;
+  SeriesIndex& operator=(const SeriesIndex&) = delete;
+
+  // eq(std::string_view stored_key) confirms a hash match. Returns 0 when absent.
+  template <typename Eq>
+  std::uint64_t Find(std::uint64_t hash, Eq&& eq) const noexcept {
+    const Table* t = table_.load(std::memory_order_acquire);
+    for (std::size_t i = hash & t->mask;; i = (i + 1) & t->mask) {
+      const Entry* e = t->slots[i].load(std::memory_order_acquire);
+      if (!e) return 0;
+      if (e->hash == hash && eq(std::string_view(e->key))) return e->value;
+    }
+  }
+  std::uint64_t Find(std::string_view key) const noexcept {
+    return Find(HashBytes(kHashSeed, key), [&](std::string_view k) { return k == key; });
+  }
+
+  // Adds key -> value (value != 0) unless the key exists; returns the stored value.
+  std::uint64_t Insert(std::string key, std::uint64_t value);
+
+  // Drops all entries and retired tables. Callers must ensure no Find is in flight.
+  void Clear();
+
+  std::size_t Size() const;
+
+ private:
+  struct Entry {
+    std::uint64_t hash;
+    std::string key;
+    std::uint64_t value;
+  };
+  struct Table {
+    explicit Table(std::size_t cap);
+    std::size_t mask;
+    std::unique_ptr<std::atomic<const Entry*>[]> slots;
+  };
+  static void Place(Table& t, const Entry* e) noexcept;
+
+  std::atomic<const Table*> table_{nullptr};
+  mutable std::mutex mu_; // writers
+  std::vector<std::unique_ptr<Entry>> entries_;
+  std::vector<std::unique_ptr<Table>> tables_; // current is back(); the rest are retired
+};
+
+// Quiescence for lock-free readers. Readers Enter/Leave around a lookup (a
+// per-shard count, so readers never share a cache line); a writer that wants
+// to free what readers may hold first closes its own gate flag, then Wait()s
+// until every count drops to zero.
+class ReaderGate {
+ public:
+  void Enter() noexcept {
+    const auto s = CurrentShard();
+    auto& n = counts_[s].n;
+    // seq_cst store: the reader's subsequent check of the caller's flag cannot
+    // be ordered before it (pairs with the writer's flag store + Wait loads).
+    if (s < kShardCount) n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+    else n.fetch_add(1, std::memory_order_seq_cst);
+  }
+  void Leave() noexcept {
+    const auto s = CurrentShard();
+    auto& n = counts_[s].n;
+    if (s < kShardCount) n.store(n.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    else n.fetch_sub(1, std::memory_order_release);
+  }
+  void Wait() const noexcept;
+
+ private:
+  struct alignas(kCacheLine) Count { std::atomic<std::int64_t> n{0}; };
+  Count counts_[kShardCount + 1];
+};
+
+} // namespace promkit
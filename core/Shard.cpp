@@ -0,0 +1,87 @@
+// Per-thread shard slot allocation
+#include "Shard.hpp"
+
+#include <promkit/promkit.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace promkit {
+
+namespace {
+
+static_assert(kShardCount == 64, "slot bitmap is a single 64-bit word");
+std::atomic<std::uint64_t> g_used{0};
+
+// Returns the slot to the pool when its thread exits. Any later write from this
+// thread (e.g. from another thread_local destructor) goes to the overflow slot.
+struct ShardOwner {
+  std::uint32_t index = kShardCount;
+  ~ShardOwner() {
+    if (index < kShardCount) g_used.fetch_and(~(std::uint64_t{1} << index), std::memory_order_release);
+    detail::t_shard = kShardCount;
+  }
+};
+
+} // namespace
+
+namespace detail {
+
+std::uint32_t ClaimShard() noexcept {
+  static thread_local ShardOwner owner;
+  auto used = g_used.load(std::memory_order_relaxed);
+  std::uint32_t idx = kShardCount;
+  while (~used != 0) {
+    const auto bit = static_cast<std::uint32_t>(std::countr_one(used));
+    // acquire: see everything the previous owner of this slot wrote
+    if (g_used.compare_exchange_weak(used, used | (std::uint64_t{1} << bit), std::memory_order_acq_rel,
+                                     std::memory_order_relaxed)) {
+      idx = bit;
+      break;
+    }
+  }
+  owner.index = idx;
+  t_shard = idx;
+  return idx;
+}
+
+} // namespace detail
+
+ShardedCounters::ShardedCounters(std::size_t columns)
+    : columns_(columns), row_lines_((columns + kPerLine - 1) / kPerLine) {
+  // value-initialized: every cell starts at 0.0
+  lines_.reset(new Line[(row_lines_ ? row_lines_ : 1) * (kShardCount + 1)]());
+}
+
+ShardedHistograms::ShardedHistograms(std::size_t columns, const std::vector<double>& bounds) : columns_(columns) {
+  constexpr std::size_t kLane = 4; // doubles per 256-bit compare
+  padded_ = (bounds.size() + kLane - 1) / kLane * kLane;
+  bounds_ = std::make_unique<double[]>(padded_ ? padded_ : 1);
+  std::fill_n(bounds_.get(), padded_, std::numeric_limits<double>::infinity());
+  std::copy(bounds.begin(), bounds.end(), bounds_.get());
+  // The tick rate is fixed once Init has calibrated the clock, before any series exists.
+  seconds_per_tick_ = SecondsPerTick();
+  tick_bounds_ = std::make_unique<double[]>(padded_ ? padded_ : 1);
+  for (std::size_t i = 0; i < padded_; ++i) tick_bounds_[i] = bounds_[i] / seconds_per_tick_;
+  buckets_ = bounds.size() + 1;
+  sum_word_ = buckets_;
+  tick_sum_word_ = buckets_ + 1;
+  col_words_ = buckets_ + 2;
+  row_lines_ = (columns_ * col_words_ + kWordsPerLine - 1) / kWordsPerLine;
+  // value-initialized: all counts and sums (bits of 0.0) start at zero
+  lines_.reset(new Line[(row_lines_ ? row_lines_ : 1) * (kShardCount + 1)]());
+}
+
+void ShardedHistograms::Snapshot(std::size_t col, std::vector<std::uint64_t>& counts, double& sum) const noexcept {
+  counts.assign(buckets_, 0);
+  sum = 0;
+  std::uint64_t ticks = 0;
+  for (std::uint32_t s = 0; s <= kShardCount; ++s) {
+    for (std::size_t i = 0; i < buckets_; ++i) counts[i] += word(s, col, i).load(std::memory_order_relaxed);
+    sum += std::bit_cast<double>(word(s, col, sum_word_).load(std::memory_order_relaxed));
+    ticks += word(s, col, tick_sum_word_).load(std::memory_order_relaxed);
+  }
+  sum += static_cast<double>(ticks) * seconds_per_tick_;
+}
+
+} // namespace promkit
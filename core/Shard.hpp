@@ -0,0 +1,144 @@
+// Per-thread shard slots: contention-free hot-path writes, summed on collect
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace promkit {
+
+inline constexpr std::size_t kCacheLine = 64;
+// Number of exclusively owned slots. Threads beyond this share one overflow
+// slot (index kShardCount) and fall back to an atomic RMW on it.
+inline constexpr std::uint32_t kShardCount = 64;
+
+namespace detail {
+inline constexpr std::uint32_t kNoShard = ~0u;
+inline thread_local std::uint32_t t_shard = kNoShard;
+// Claims a free slot for the calling thread (released on thread exit).
+std::uint32_t ClaimShard() noexcept;
+} // namespace detail
+
+// Slot index of the calling thread in [0, kShardCount]; < kShardCount means the
+// thread is the only writer of that slot.
+inline std::uint32_t CurrentShard() noexcept {
+  const auto s = detail::t_shard;
+  return s != detail::kNoShard ? s : detail::ClaimShard();
+}
+
+// Counters of one metric split into per-thread rows. A row holds one cell per
+// series (column), padded to whole cache lines, so a thread's cells for all
+// series of the metric are adjacent and no two threads share a line. Owners
+// add with a plain relaxed load/store (no CAS); readers sum a column.
+class ShardedCounters {
+ public:
+  explicit ShardedCounters(std::size_t columns);
+
+  void Add(std::size_t col, double v) noexcept { AddOn(CurrentShard(), col, v); }
+  // Same as Add for a caller that already holds its CurrentShard() (batches).
+  void AddOn(std::uint32_t s, std::size_t col, double v) noexcept {
+    auto& c = cell(s, col);
+    if (s < kShardCount) c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    else c.fetch_add(v, std::memory_order_relaxed);
+  }
+  double Sum(std::size_t col) const noexcept {
+    double sum = 0;
+    for (std::uint32_t s = 0; s <= kShardCount; ++s) sum += cell(s, col).load(std::memory_order_relaxed);
+    return sum;
+  }
+  std::size_t Columns() const noexcept { return columns_; }
+
+ private:
+  static constexpr std::size_t kPerLine = kCacheLine / sizeof(double);
+  struct alignas(kCacheLine) Line { std::atomic<double> v[kPerLine]; };
+
+  std::atomic<double>& cell(std::uint32_t shard, std::size_t col) const noexcept {
+    return lines_[shard * row_lines_ + col / kPerLine].v[col % kPerLine];
+  }
+
+  std::size_t columns_ = 0;
+  std::size_t row_lines_ = 0;
+  std::unique_ptr<Line[]> lines_;
+};
+
+// Histograms of one metric (shared bucket bounds) split into per-thread rows.
+// Within a row each series (column) has the non-cumulative bucket counts
+// (bounds + the +Inf bucket), the sum (stored as double bits) and the tick sum;
+// rows are padded to whole cache lines.
+class ShardedHistograms {
+ public:
+  ShardedHistograms(std::size_t columns, const std::vector<double>& bounds);
+
+  void Observe(std::size_t col, double v) noexcept { ObserveOn(CurrentShard(), col, v); }
+  void ObserveOn(std::uint32_t s, std::size_t col, double v) noexcept {
+    auto& bucket = word(s, col, IndexIn(bounds_.get(), v));
+    auto& sum = word(s, col, sum_word_);
+    if (s < kShardCount) {
+      bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      sum.store(std::bit_cast<std::uint64_t>(std::bit_cast<double>(sum.load(std::memory_order_relaxed)) + v),
+                std::memory_order_relaxed);
+    } else {
+      bucket.fetch_add(1, std::memory_order_relaxed);
+      auto old = sum.load(std::memory_order_relaxed);
+      while (!sum.compare_exchange_weak(old, std::bit_cast<std::uint64_t>(std::bit_cast<double>(old) + v),
+                                        std::memory_order_relaxed)) {}
+    }
+  }
+
+  // Duration in raw ticks: bucketed against bounds pre-scaled to ticks, summed
+  // as an integer and converted to seconds only in Snapshot.
+  void ObserveTicks(std::size_t col, std::uint64_t ticks) noexcept { ObserveTicksOn(CurrentShard(), col, ticks); }
+  void ObserveTicksOn(std::uint32_t s, std::size_t col, std::uint64_t ticks) noexcept {
+    auto& bucket = word(s, col, IndexIn(tick_bounds_.get(), static_cast<double>(ticks)));
+    auto& sum = word(s, col, tick_sum_word_);
+    if (s < kShardCount) {
+      bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      sum.store(sum.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+    } else {
+      bucket.fetch_add(1, std::memory_order_relaxed);
+      sum.fetch_add(ticks, std::memory_order_relaxed);
+    }
+  }
+
+  // Index of the first bucket with le >= v (+Inf for NaN).
+  std::size_t BucketIndex(double v) const noexcept { return IndexIn(bounds_.get(), v); }
+
+  std::size_t BucketCount() const noexcept { return buckets_; } // including +Inf
+  std::size_t Columns() const noexcept { return columns_; }
+
+  // Totals of one series across shards: non-cumulative counts (size BucketCount()) and sum.
+  void Snapshot(std::size_t col, std::vector<std::uint64_t>& counts, double& sum) const noexcept;
+
+ private:
+  // Number of bounds below v; NaN goes to +Inf only, as in prometheus-cpp.
+  // Branch-free over the padded bounds so the loop vectorizes.
+  std::size_t IndexIn(const double* bounds, double v) const noexcept {
+    std::size_t idx = 0;
+    for (std::size_t i = 0; i < padded_; ++i) idx += static_cast<std::size_t>(bounds[i] < v);
+    return v == v ? idx : buckets_ - 1;
+  }
+
+  static constexpr std::size_t kWordsPerLine = kCacheLine / sizeof(std::uint64_t);
+  struct alignas(kCacheLine) Line { std::atomic<std::uint64_t> w[kWordsPerLine]; };
+
+  std::atomic<std::uint64_t>& word(std::uint32_t shard, std::size_t col, std::size_t i) const noexcept {
+    const std::size_t at = col * col_words_ + i;
+    return lines_[shard * row_lines_ + at / kWordsPerLine].w[at % kWordsPerLine];
+  }
+
+  std::unique_ptr<double[]> bounds_;      // finite bounds padded with +Inf
+  std::unique_ptr<double[]> tick_bounds_; // same bounds in ticks of the tick clock
+  double seconds_per_tick_ = 0;
+  std::size_t padded_ = 0;
+  std::size_t buckets_ = 0;
+  std::size_t sum_word_ = 0;
+  std::size_t tick_sum_word_ = 0;
+  std::size_t col_words_ = 0;
+  std::size_t columns_ = 0;
+  std::size_t row_lines_ = 0;
+  std::unique_ptr<Line[]> lines_;
+};
+
+} // namespace promkit
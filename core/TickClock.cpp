@@ -0,0 +1,73 @@
+// Tick clock: invariant TSC detection and calibration
+#include "TickClock.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#  include <cpuid.h>
+#endif
+
+namespace promkit {
+
+namespace detail {
+std::atomic<bool> g_use_tsc{false};
+std::atomic<double> g_seconds_per_tick{1e-9};
+} // namespace detail
+
+namespace {
+
+static bool HasInvariantTsc() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int regs[4] = {};
+  __cpuid(regs, 0x80000000);
+  if (static_cast<unsigned>(regs[0]) < 0x80000007u) return false;
+  __cpuid(regs, 0x80000007);
+  return (regs[3] & (1 << 8)) != 0;
+#elif defined(__x86_64__) || defined(__i386__)
+  unsigned a = 0, b = 0, c = 0, d = 0;
+  if (__get_cpuid_max(0x80000000u, nullptr) < 0x80000007u) return false;
+  if (!__get_cpuid(0x80000007u, &a, &b, &c, &d)) return false;
+  return (d & (1u << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+// Switches to the TSC at its measured rate; false (steady clock kept) when it cannot.
+static bool CalibrateTsc() noexcept {
+#if PROMKIT_HAS_TSC
+  if (!HasInvariantTsc()) return false;
+  using Clock = std::chrono::steady_clock;
+  const auto t0 = Clock::now();
+  const auto c0 = detail::Rdtsc();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  const auto t1 = Clock::now();
+  const auto c1 = detail::Rdtsc();
+  const double secs = std::chrono::duration<double>(t1 - t0).count();
+  if (c1 <= c0 || secs <= 0) return false;
+  detail::g_seconds_per_tick.store(secs / static_cast<double>(c1 - c0), std::memory_order_relaxed);
+  detail::g_use_tsc.store(true, std::memory_order_release);
+  return true;
+#else
+  return false;
+#endif
+}
+
+} // namespace
+
+bool SelectTickClock(bool tsc) noexcept {
+  static std::once_flag once;
+  try {
+    std::call_once(once, [tsc] {
+      if (tsc) CalibrateTsc();
+    });
+  } catch (...) {}
+  return detail::g_use_tsc.load(std::memory_order_acquire);
+}
+
+} // namespace promkit
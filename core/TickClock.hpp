@@ -0,0 +1,14 @@
+// Tick clock calibration (the hot-path reader lives in promkit.hpp)
+#pragma once
+#include <promkit/promkit.hpp>
+
+namespace promkit {
+
+// Picks the tick source on the first call of the process: the TSC when tsc is
+// set and the CPU reports an invariant TSC (its rate measured against
+// steady_clock, ~20ms), steady_clock nanoseconds otherwise. Later calls keep
+// that choice whatever they ask for, as ScopeTimers started before a re-Init
+// must end on the clock they started on. Returns whether the TSC is in use.
+bool SelectTickClock(bool tsc) noexcept;
+
+} // namespace promkit
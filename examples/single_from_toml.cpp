@@ -3,6 +3,10 @@
 #include <thread>
 #include <chrono>
 
+// Dynamic label values by position in the TOML dynamic_labels lists
+enum class Result { ok, error };
+enum class Stage { parse, validate, write, respond };
+
 int main(int argc, char** argv) {
   if (argc < 2) {
     std::cerr << "Usage: " << argv[0] << " <config.toml>" << std::endl;
@@ -15,19 +19,19 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  auto c_ok = promkit::CreateCounter("orders_processed_total", "Total processed", {{"result","ok"}});
-  auto c_err = promkit::CreateCounter("orders_processed_total", "Total processed", {{"result","error"}});
+  // Family handles resolve all pre-registered series once; recording is an array index.
+  promkit::CounterFamily<Result> processed("orders_processed_total", {"result"});
+  promkit::HistogramFamily<Stage> latency("order_processing_seconds", {"stage"});
   auto g_backlog = promkit::CreateGauge("order_backlog", "Pending queue length");
-  auto h_latency = promkit::CreateHistogram("order_processing_seconds", "Latency", {0.001,0.005,0.01,0.05,0.1,0.25,0.5,1});
 
   using namespace std::chrono_literals;
   std::cout << "Metrics server started (see config path). Generating sample data..." << std::endl;
   for (int i = 0; i < 20; ++i) {
-    promkit::CounterAdd(c_ok, 1);
-    if (i % 5 == 0) promkit::CounterAdd(c_err, 1);
+    processed.Add(1, Result::ok);
+    if (i % 5 == 0) processed.Add(1, Result::error);
     promkit::GaugeSet(g_backlog, 100 - i);
     {
-      promkit::ScopeTimer t(h_latency);
+      promkit::ScopeTimer t(latency.At(Stage::write));
       std::this_thread::sleep_for(5ms + std::chrono::milliseconds(i % 7));
     }
     std::this_thread::sleep_for(200ms);
@@ -4,11 +4,17 @@
 // - Programmatic config (TOML file support to be added later)
 // - Opaque metric ids to avoid exposing prometheus-cpp types in public headers
 
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <chrono>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
 
 namespace promkit {
 
@@ -20,11 +26,22 @@ struct Config {
   std::string path = "/metrics";   // metrics path
   std::string prefix;               // optional name prefix: <prefix>_<metric>
   std::map<std::string, std::string> labels; // global labels injected to every series
+  std::string counter_mode = "atomic"; // "atomic" | "sharded" (per-thread slots) | "local" (per-thread rows, any thread count)
+  std::string histogram_mode = "atomic"; // "atomic" | "sharded" (per-thread bucket arrays merged at collect)
+  std::string timer_clock = "steady";    // "steady" | "tsc" (ScopeTimer tick source, fixed by the first Init; falls back to steady)
+  std::string mux_transport = "http";    // mux worker -> aggregator: "http" | "shm" (mmap segment, POSIX)
+  int         mux_publish_ms = 1000;     // unused: shm workers publish when the aggregator asks (kept for configs)
+  int         mux_worker_timeout_ms = 2000; // aggregator: deadline for one worker fetch
+  int         mux_scrape_budget_ms = 8000;  // aggregator: bound on fetching all workers
+  int         scrape_cache_ms = 0;          // reuse the last scrape response (and mux merge) this long; 0: always fresh
+  int         gzip_level = 6;               // 1..9: gzip /metrics when the scraper accepts it (needs zlib); 0: off
+  bool        self_metrics = false;         // also export promkit_* metrics about scrapes, series and rejected Create*
 };
 
 using CounterId = std::uint64_t;
 using GaugeId = std::uint64_t;
 using HistogramId = std::uint64_t;
+using SummaryId = std::uint64_t;
 
 // Lifecycle
 bool Init(const Config& cfg) noexcept;
@@ -55,16 +72,194 @@ HistogramId CreateHistogram(const std::string& name,
                             const std::vector<double>& buckets,
                             const std::map<std::string, std::string>& const_labels = {}) noexcept;
 void HistogramObserve(HistogramId id, double value) noexcept;
+// Observe a duration in ticks of the tick clock below (see ReadTicks).
+void HistogramObserveTicks(HistogramId id, std::uint64_t ticks) noexcept;
 
-// RAII timer for latency (observes on destruction)
+// Summaries: count, sum and quantiles over a sliding window, estimated within
+// a relative error by a mergeable sketch. Quantiles, accuracy and window come
+// from the metric's [[metrics]] entry; ad-hoc summaries use the defaults.
+SummaryId CreateSummary(const std::string& name,
+                        const std::string& help,
+                        const std::map<std::string, std::string>& const_labels = {}) noexcept;
+void SummaryObserve(SummaryId id, double value) noexcept;
+
+// Dense family handles
+// Resolves every series of a TOML-defined metric once, laid out in mixed-radix
+// order of `keys` (first key most significant); a label value is addressed by
+// its position in the metric's dynamic_labels list. Returns false (and leaves
+// ids empty) when the metric is not defined with exactly these dynamic keys.
+enum class MetricKind : std::uint8_t { Counter, Gauge, Histogram, Summary };
+bool ResolveFamily(MetricKind kind, const std::string& name, const std::vector<std::string>& keys,
+                   std::vector<std::uint64_t>& ids, std::vector<std::uint32_t>& radix) noexcept;
+
+namespace detail {
+// Labels... are enums (or integers) whose values 0..n-1 follow the TOML value
+// order, e.g. dynamic_labels = { side = ["buy", "sell"] } <-> enum class Side { buy, sell }.
+template <MetricKind Kind, typename... Labels>
+class DenseFamily {
+  static_assert(sizeof...(Labels) > 0, "a family needs at least one dynamic label");
+  static_assert(((std::is_enum_v<Labels> || std::is_integral_v<Labels>) && ...),
+                "family labels must be enums or integers indexing dynamic_labels values");
+
+ public:
+  static constexpr std::size_t kArity = sizeof...(Labels);
+
+  DenseFamily() = default;
+  DenseFamily(const std::string& name, const std::array<std::string, kArity>& keys) {
+    std::vector<std::uint32_t> radix;
+    if (ResolveFamily(Kind, name, std::vector<std::string>(keys.begin(), keys.end()), ids_, radix)) {
+      for (std::size_t i = 0; i < kArity; ++i) radix_[i] = radix[i];
+    }
+  }
+
+  bool valid() const noexcept { return !ids_.empty(); }
+
+  // Series id for one label combination; 0 (a no-op id) when out of range.
+  std::uint64_t At(Labels... v) const noexcept {
+    std::size_t idx = 0, i = 0;
+    bool in_range = true;
+    ((in_range &= static_cast<std::size_t>(v) < radix_[i], idx = idx * radix_[i] + static_cast<std::size_t>(v), ++i), ...);
+    return in_range && !ids_.empty() ? ids_[idx] : 0;
+  }
+
+ private:
+  std::vector<std::uint64_t> ids_;
+  std::array<std::uint32_t, kArity> radix_{};
+};
+} // namespace detail
+
+template <typename... Labels>
+class CounterFamily : public detail::DenseFamily<MetricKind::Counter, Labels...> {
+ public:
+  using detail::DenseFamily<MetricKind::Counter, Labels...>::DenseFamily;
+  void Add(double value, Labels... v) const noexcept { CounterAdd(this->At(v...), value); }
+};
+
+template <typename... Labels>
+class GaugeFamily : public detail::DenseFamily<MetricKind::Gauge, Labels...> {
+ public:
+  using detail::DenseFamily<MetricKind::Gauge, Labels...>::DenseFamily;
+  void Set(double value, Labels... v) const noexcept { GaugeSet(this->At(v...), value); }
+  void Add(double delta, Labels... v) const noexcept { GaugeAdd(this->At(v...), delta); }
+};
+
+// Use At(...) with ScopeTimer to time into one series.
+template <typename... Labels>
+class HistogramFamily : public detail::DenseFamily<MetricKind::Histogram, Labels...> {
+ public:
+  using detail::DenseFamily<MetricKind::Histogram, Labels...>::DenseFamily;
+  void Observe(double value, Labels... v) const noexcept { HistogramObserve(this->At(v...), value); }
+};
+
+template <typename... Labels>
+class SummaryFamily : public detail::DenseFamily<MetricKind::Summary, Labels...> {
+ public:
+  using detail::DenseFamily<MetricKind::Summary, Labels...>::DenseFamily;
+  void Observe(double value, Labels... v) const noexcept { SummaryObserve(this->At(v...), value); }
+};
+
+// Batched recording
+// One update of a batch; ids of any kind, 0 ids are skipped.
+enum class BatchOpKind : std::uint8_t {
+  CounterAdd, GaugeSet, GaugeAdd, HistogramObserve, HistogramObserveTicks, SummaryObserve
+};
+struct BatchOp {
+  BatchOpKind kind;
+  std::uint64_t id;
+  double value;        // all kinds but HistogramObserveTicks
+  std::uint64_t ticks; // HistogramObserveTicks
+};
+// Applies ops in order, checking the backend state and the calling thread's
+// shard once for the whole batch instead of once per update.
+void RecordBatch(const BatchOp* ops, std::size_t n) noexcept;
+
+// Stack-local recorder for the updates of one event; commits on Commit() or
+// destruction (and early, when kCapacity updates are pending).
+//   promkit::Batch b;
+//   b.CounterAdd(orders); b.GaugeAdd(inflight, 1); b.HistogramObserve(size, qty);
+class Batch {
+ public:
+  static constexpr std::size_t kCapacity = 16;
+
+  Batch() noexcept = default;
+  ~Batch() noexcept { Commit(); }
+  Batch(const Batch&) = delete;
+  Batch& operator=(const Batch&) = delete;
+
+  void CounterAdd(CounterId id, double value = 1.0) noexcept { push(BatchOpKind::CounterAdd, id, value, 0); }
+  void GaugeSet(GaugeId id, double value) noexcept { push(BatchOpKind::GaugeSet, id, value, 0); }
+  void GaugeAdd(GaugeId id, double delta) noexcept { push(BatchOpKind::GaugeAdd, id, delta, 0); }
+  void HistogramObserve(HistogramId id, double value) noexcept { push(BatchOpKind::HistogramObserve, id, value, 0); }
+  void HistogramObserveTicks(HistogramId id, std::uint64_t ticks) noexcept {
+    push(BatchOpKind::HistogramObserveTicks, id, 0, ticks);
+  }
+  void SummaryObserve(SummaryId id, double value) noexcept { push(BatchOpKind::SummaryObserve, id, value, 0); }
+
+  void Commit() noexcept {
+    if (n_ != 0) RecordBatch(ops_.data(), n_);
+    n_ = 0;
+  }
+
+ private:
+  void push(BatchOpKind kind, std::uint64_t id, double value, std::uint64_t ticks) noexcept {
+    if (id == 0) return;
+    if (n_ == kCapacity) Commit();
+    ops_[n_++] = BatchOp{kind, id, value, ticks};
+  }
+
+  std::array<BatchOp, kCapacity> ops_; // only [0, n_) is initialized
+  std::size_t n_ = 0;
+};
+
+// Tick clock: the TSC when Config::timer_clock == "tsc" and the CPU has an
+// invariant TSC (detected and calibrated at the process's first Init, which
+// fixes the choice for good), steady_clock nanoseconds otherwise. Sharded histograms keep raw ticks and convert them at collect.
+namespace detail {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define PROMKIT_HAS_TSC 1
+inline std::uint64_t Rdtsc() noexcept { return __rdtsc(); }
+inline std::uint64_t Rdtscp() noexcept { unsigned aux; return __rdtscp(&aux); }
+#elif defined(__x86_64__) || defined(__i386__)
+#define PROMKIT_HAS_TSC 1
+inline std::uint64_t Rdtsc() noexcept { return __builtin_ia32_rdtsc(); }
+inline std::uint64_t Rdtscp() noexcept { unsigned aux; return __builtin_ia32_rdtscp(&aux); }
+#else
+#define PROMKIT_HAS_TSC 0
+#endif
+extern std::atomic<bool> g_use_tsc;
+extern std::atomic<double> g_seconds_per_tick;
+
+inline std::uint64_t SteadyNanos() noexcept {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+} // namespace detail
+
+// Start-of-interval read.
+inline std::uint64_t ReadTicks() noexcept {
+#if PROMKIT_HAS_TSC
+  if (detail::g_use_tsc.load(std::memory_order_relaxed)) return detail::Rdtsc();
+#endif
+  return detail::SteadyNanos();
+}
+// End-of-interval read (rdtscp: waits for the timed work to retire).
+inline std::uint64_t ReadTicksEnd() noexcept {
+#if PROMKIT_HAS_TSC
+  if (detail::g_use_tsc.load(std::memory_order_relaxed)) return detail::Rdtscp();
+#endif
+  return detail::SteadyNanos();
+}
+inline double SecondsPerTick() noexcept { return detail::g_seconds_per_tick.load(std::memory_order_relaxed); }
+
+// RAII timer for latency (observes on destruction, in ticks of the tick clock).
+// An interval that reads backwards (TSCs not synchronized across sockets) is dropped.
 class ScopeTimer {
  public:
-  explicit ScopeTimer(HistogramId hid) noexcept : hid_(hid), start_(Clock::now()) {}
+  explicit ScopeTimer(HistogramId hid) noexcept : hid_(hid), start_(ReadTicks()) {}
   ~ScopeTimer() noexcept {
-    if (hid_ != 0) {
-      auto elapsed = std::chrono::duration<double>(Clock::now() - start_).count();
-      HistogramObserve(hid_, elapsed);
-    }
+    if (hid_ == 0) return;
+    const auto end = ReadTicksEnd();
+    if (end >= start_) HistogramObserveTicks(hid_, end - start_);
   }
   // Disallow copy; allow move
   ScopeTimer(const ScopeTimer&) = delete;
@@ -75,9 +270,8 @@ class ScopeTimer {
     return *this;
   }
  private:
-  using Clock = std::chrono::steady_clock;
   HistogramId hid_ = 0;
-  Clock::time_point start_{};
+  std::uint64_t start_ = 0;
 };
 
 } // namespace promkit
@@ -0,0 +1,58 @@
+#include "FamilyPool.hpp"
+
+#include <utility>
+
+namespace promkit::mux {
+
+void FamilyPool::Recycle(std::vector<prometheus::MetricFamily>&& fams) {
+  for (auto& f : fams) {
+    for (auto& m : f.metric) metrics_.push_back(std::move(m));
+    f.metric.clear();
+    fams_.push_back(std::move(f));
+  }
+  fams.clear();
+}
+
+prometheus::MetricFamily FamilyPool::Family() {
+  if (fams_.empty()) return {};
+  auto f = std::move(fams_.back());
+  fams_.pop_back();
+  f.name.clear();
+  f.help.clear();
+  f.type = {};
+  return f;
+}
+
+prometheus::ClientMetric FamilyPool::Metric() {
+  if (metrics_.empty()) return {};
+  // Keep the vectors, reset everything else whatever members this
+  // prometheus-cpp version has
+  auto spare = std::move(metrics_.back());
+  metrics_.pop_back();
+  auto label = std::move(spare.label);
+  auto quantile = std::move(spare.summary.quantile);
+  auto bucket = std::move(spare.histogram.bucket);
+  prometheus::ClientMetric m;
+  label.clear();
+  quantile.clear();
+  bucket.clear();
+  m.label = std::move(label);
+  m.summary.quantile = std::move(quantile);
+  m.histogram.bucket = std::move(bucket);
+  return m;
+}
+
+void FamilyPool::Assign(const std::vector<prometheus::MetricFamily>& src, std::vector<prometheus::MetricFamily>& out) {
+  out.clear();
+  out.reserve(src.size());
+  for (const auto& s : src) {
+    auto& f = out.emplace_back(Family());
+    f.name = s.name;
+    f.help = s.help;
+    f.type = s.type;
+    f.metric.reserve(s.metric.size());
+    for (const auto& sm : s.metric) f.metric.emplace_back(Metric()) = sm; // copies into the spare's capacity
+  }
+}
+
+} // namespace promkit::mux
@@ -0,0 +1,36 @@
+// Recycled family and series storage for the mux merge
+#pragma once
+
+#include <prometheus/metric_family.h>
+
+#include <vector>
+
+namespace promkit::mux {
+
+// Families and series of a merge that has been served, kept for a later merge
+// to build into. prometheus-cpp types allocate through std::allocator, so
+// scrape-time data cannot live in a per-scrape arena; instead the label,
+// bucket, quantile and series vectors of an old merge are handed back whole and
+// the parser, the shm reader and MergeTable fill them again. Once series
+// shapes settle, a merge reuses the capacity of an earlier one instead of
+// allocating and freeing it. Not thread-safe.
+class FamilyPool {
+ public:
+  // Takes fams apart into spare families and series.
+  void Recycle(std::vector<prometheus::MetricFamily>&& fams);
+  // A spare family with no name, help or series (metric capacity kept), or a new one.
+  prometheus::MetricFamily Family();
+  // A spare series with no labels, default values and no buckets or quantiles
+  // (capacity kept), or a new one.
+  prometheus::ClientMetric Metric();
+  // out = src, built from spares.
+  void Assign(const std::vector<prometheus::MetricFamily>& src, std::vector<prometheus::MetricFamily>& out);
+
+  bool empty() const noexcept { return fams_.empty() && metrics_.empty(); }
+
+ private:
+  std::vector<prometheus::MetricFamily> fams_;
+  std::vector<prometheus::ClientMetric> metrics_;
+};
+
+} // namespace promkit::mux
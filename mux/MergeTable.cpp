@@ -0,0 +1,293 @@
+#include "MergeTable.hpp"
+
+#include "QuantileSketch.hpp"
+#include "SeriesIndex.hpp"
+
+#include <prometheus/metric_type.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace promkit::mux {
+
+namespace {
+
+using Label = prometheus::ClientMetric::Label;
+using Bucket = prometheus::ClientMetric::Bucket;
+
+// Linear probing over power-of-two tables kept at most half full. Returns the
+// position of the entry eq accepts, or of the empty slot where it belongs.
+template <typename SlotT, typename Eq>
+std::size_t Probe(const std::vector<SlotT>& slots, std::uint64_t h, Eq eq) {
+  const std::size_t mask = slots.size() - 1;
+  for (std::size_t i = h & mask;; i = (i + 1) & mask) {
+    const auto& s = slots[i];
+    if (s.index == 0 || (s.hash == h && eq(s.index - 1))) return i;
+  }
+}
+
+template <typename SlotT>
+void ReserveSlots(std::vector<SlotT>& slots, std::size_t entries) {
+  if ((entries + 1) * 2 <= slots.size()) return;
+  std::vector<SlotT> grown(std::max<std::size_t>(16, slots.size() * 2));
+  for (const auto& s : slots) {
+    if (s.index != 0) grown[Probe(grown, s.hash, [](std::uint32_t) { return false; })] = s;
+  }
+  slots.swap(grown);
+}
+
+inline std::uint64_t Mix(std::uint64_t h, std::uint64_t v) { return h ^ (v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)); }
+
+bool LabelLess(const Label* a, const Label* b) { return *a < *b; }
+
+// Cumulative counts summed per upper bound: by index when both sides use the
+// same bounds (the usual case), else by a sorted merge over the union of bounds.
+void MergeBuckets(std::vector<Bucket>& dst, const std::vector<Bucket>& src, std::vector<Bucket>& scratch) {
+  auto byBound = [](const Bucket& a, const Bucket& b) { return a.upper_bound < b.upper_bound; };
+  if (dst.empty()) {
+    dst = src;
+    if (!std::is_sorted(dst.begin(), dst.end(), byBound)) std::sort(dst.begin(), dst.end(), byBound);
+    return;
+  }
+  if (dst.size() == src.size()) {
+    std::size_t i = 0;
+    while (i < src.size() && dst[i].upper_bound == src[i].upper_bound) ++i;
+    if (i == src.size()) {
+      for (i = 0; i < src.size(); ++i) dst[i].cumulative_count += src[i].cumulative_count;
+      return;
+    }
+  }
+  const std::vector<Bucket>* in = &src;
+  std::vector<Bucket> sorted;
+  if (!std::is_sorted(src.begin(), src.end(), byBound)) {
+    sorted = src;
+    std::sort(sorted.begin(), sorted.end(), byBound);
+    in = &sorted;
+  }
+  // Union of the bounds; at each bound both sides contribute their cumulative
+  // count at the nearest bound at or below it (native histograms only list
+  // their non-empty buckets, so bound sets differ between workers).
+  scratch.clear();
+  scratch.reserve(dst.size() + in->size());
+  auto a = dst.begin();
+  auto b = in->begin();
+  std::uint64_t ca = 0, cb = 0;
+  while (a != dst.end() || b != in->end()) {
+    double bound;
+    if (b == in->end() || (a != dst.end() && a->upper_bound < b->upper_bound)) {
+      bound = a->upper_bound;
+      ca = (a++)->cumulative_count;
+    } else if (a == dst.end() || b->upper_bound < a->upper_bound) {
+      bound = b->upper_bound;
+      cb = (b++)->cumulative_count;
+    } else {
+      bound = a->upper_bound;
+      ca = (a++)->cumulative_count;
+      cb = (b++)->cumulative_count;
+    }
+    auto& out = scratch.emplace_back();
+    out.upper_bound = bound;
+    out.cumulative_count = ca + cb;
+  }
+  dst.swap(scratch);
+}
+
+// A sketch-form histogram (see MergePolicy::quantiles) as the summary it stands
+// for. The window is in the finite buckets; +Inf and count hold the summary's
+// count, observations that left the window included.
+void SketchToSummary(prometheus::ClientMetric& m, const MergePolicy& policy,
+                     std::vector<std::pair<double, std::uint64_t>>& scratch) {
+  std::erase_if(m.label, [](const auto& l) { return l.name == kSketchLabel; });
+  auto& h = m.histogram;
+  scratch.clear();
+  std::uint64_t prev = 0;
+  for (const auto& b : h.bucket) {
+    if (std::isinf(b.upper_bound)) continue;
+    scratch.emplace_back(b.upper_bound, b.cumulative_count - prev);
+    prev = b.cumulative_count;
+  }
+  auto& sm = m.summary;
+  sm.sample_count = h.sample_count;
+  sm.sample_sum = h.sample_sum;
+  sm.quantile.clear();
+  for (double q : policy.quantiles) sm.quantile.push_back({q, SketchQuantile(scratch, q, policy.sketch_schema)});
+  h = {};
+}
+
+// The sketch marker on m, or empty.
+std::string_view SketchMarkerOf(const prometheus::ClientMetric& m) {
+  for (const auto& l : m.label) {
+    if (l.name == kSketchLabel) return l.value;
+  }
+  return {};
+}
+
+} // namespace
+
+std::string SketchMarker(int schema, const std::vector<double>& quantiles) {
+  std::string out = std::to_string(schema);
+  char buf[32];
+  for (std::size_t i = 0; i < quantiles.size(); ++i) {
+    out += i == 0 ? ':' : ',';
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), quantiles[i]).ptr);
+  }
+  return out;
+}
+
+bool ParseSketchMarker(std::string_view marker, MergePolicy& policy) {
+  const char* p = marker.data();
+  const char* const end = p + marker.size();
+  int schema = 0;
+  auto r = std::from_chars(p, end, schema);
+  if (r.ec != std::errc{} || r.ptr == end || *r.ptr != ':') return false;
+  std::vector<double> quantiles;
+  for (p = r.ptr; p != end && (*p == ':' || *p == ',');) {
+    double q = 0;
+    const auto rq = std::from_chars(p + 1, end, q);
+    if (rq.ec != std::errc{} || !(q >= 0 && q <= 1)) return false;
+    quantiles.push_back(q);
+    p = rq.ptr;
+  }
+  if (p != end) return false;
+  policy.quantiles = std::move(quantiles);
+  policy.sketch_schema = schema;
+  return true;
+}
+
+MergePolicy MakeMergePolicy(std::string_view type, std::string_view publish, std::string_view gauge_agg) {
+  MergePolicy p;
+  if (gauge_agg == "last") p.gauge_agg = MergePolicy::GaugeAgg::Last;
+  else if (gauge_agg == "max") p.gauge_agg = MergePolicy::GaugeAgg::Max;
+  if (publish == "sum_only") {
+    p.per_proc = false;
+  } else if (publish == "per_proc") {
+    p.aggregate = false;
+  } else if (publish != "both" && type == "gauge") {
+    p.aggregate = !gauge_agg.empty();
+  }
+  return p;
+}
+
+MergeTable::Family& MergeTable::FamilyFor(const prometheus::MetricFamily& f) {
+  const auto h = Mix(HashBytes(kHashSeed, f.name), static_cast<std::uint64_t>(f.type));
+  ReserveSlots(fam_slots_, fams_.size());
+  const auto pos = Probe(fam_slots_, h, [&](std::uint32_t i) {
+    return fams_[i].fam.type == f.type && fams_[i].fam.name == f.name;
+  });
+  auto& slot = fam_slots_[pos];
+  if (slot.index != 0) return fams_[slot.index - 1];
+  slot = {h, static_cast<std::uint32_t>(fams_.size() + 1)};
+  auto& fam = fams_.emplace_back();
+  if (pool_) fam.fam = pool_->Family();
+  fam.fam.name = f.name;
+  fam.fam.type = f.type;
+  if (auto it = policies_ ? policies_->find(f.name) : MergePolicies::const_iterator{}; policies_ && it != policies_->end()) {
+    fam.policy = it->second;
+  } else {
+    fam.policy.aggregate = f.type != prometheus::MetricType::Gauge; // gauges default to per_proc
+  }
+  // Only counters, gauges and histograms can be summed; never drop the others
+  if (f.type != prometheus::MetricType::Counter && f.type != prometheus::MetricType::Gauge &&
+      f.type != prometheus::MetricType::Histogram) {
+    fam.policy.aggregate = false;
+  }
+  if (!fam.policy.aggregate) fam.policy.per_proc = true;
+  return fam;
+}
+
+prometheus::ClientMetric& MergeTable::AggregateFor(Family& fam, const prometheus::ClientMetric& m, bool& fresh) {
+  // Key: labels other than component, sorted; workers normally send them sorted already
+  key_.clear();
+  for (const auto& l : m.label) {
+    if (l.name != "component") key_.push_back(&l);
+  }
+  if (!std::is_sorted(key_.begin(), key_.end(), LabelLess)) std::sort(key_.begin(), key_.end(), LabelLess);
+  std::uint64_t h = kHashSeed;
+  for (const auto* l : key_) {
+    h = HashBytes(h, l->name);
+    h = HashBytes(h, std::string_view("=", 2)); // name/value separator, NUL included
+    h = HashBytes(h, l->value);
+    h = HashBytes(h, std::string_view("|", 2));
+  }
+  ReserveSlots(fam.agg_slots, fam.agg.size());
+  const auto pos = Probe(fam.agg_slots, h, [&](std::uint32_t i) {
+    const auto& labs = fam.agg[i].label;
+    if (labs.size() != key_.size()) return false;
+    for (std::size_t k = 0; k < labs.size(); ++k) {
+      if (labs[k].name != key_[k]->name || labs[k].value != key_[k]->value) return false;
+    }
+    return true;
+  });
+  auto& slot = fam.agg_slots[pos];
+  fresh = slot.index == 0;
+  if (!fresh) return fam.agg[slot.index - 1];
+  slot = {h, static_cast<std::uint32_t>(fam.agg.size() + 1)};
+  auto& dst = pool_ ? fam.agg.emplace_back(pool_->Metric()) : fam.agg.emplace_back();
+  dst.label.reserve(key_.size());
+  for (const auto* l : key_) dst.label.push_back(*l);
+  return dst;
+}
+
+void MergeTable::Add(prometheus::MetricFamily&& f) {
+  using prometheus::MetricType;
+  auto& fam = FamilyFor(f);
+  // An unlisted summary in sketch form still leaves as a summary
+  if (f.type == MetricType::Histogram && fam.policy.quantiles.empty() && !f.metric.empty()) {
+    if (const auto marker = SketchMarkerOf(f.metric.front()); !marker.empty()) ParseSketchMarker(marker, fam.policy);
+  }
+  // Keep first non-empty help
+  if (fam.fam.help.empty() && !f.help.empty()) fam.fam.help = std::move(f.help);
+  bool fresh = false;
+  if (fam.policy.aggregate) {
+    for (const auto& m : f.metric) {
+      auto& dst = AggregateFor(fam, m, fresh);
+      switch (f.type) {
+        case MetricType::Counter: dst.counter.value += m.counter.value; break;
+        case MetricType::Histogram:
+          dst.histogram.sample_count += m.histogram.sample_count;
+          dst.histogram.sample_sum += m.histogram.sample_sum;
+          MergeBuckets(dst.histogram.bucket, m.histogram.bucket, buckets_);
+          break;
+        case MetricType::Gauge:
+          switch (fam.policy.gauge_agg) {
+            case MergePolicy::GaugeAgg::Sum: dst.gauge.value += m.gauge.value; break;
+            case MergePolicy::GaugeAgg::Last: dst.gauge.value = m.gauge.value; break;
+            case MergePolicy::GaugeAgg::Max: dst.gauge.value = fresh ? m.gauge.value : std::max(dst.gauge.value, m.gauge.value); break;
+          }
+          break;
+        default: break;
+      }
+    }
+  }
+  if (!fam.policy.per_proc) return;
+  auto& out = fam.fam.metric;
+  if (out.empty()) {
+    out = std::move(f.metric);
+  } else {
+    out.insert(out.end(), std::make_move_iterator(f.metric.begin()), std::make_move_iterator(f.metric.end()));
+  }
+}
+
+std::vector<prometheus::MetricFamily> MergeTable::Take() {
+  std::vector<prometheus::MetricFamily> out;
+  out.reserve(fams_.size());
+  for (auto& fam : fams_) {
+    auto& metric = fam.fam.metric;
+    metric.insert(metric.end(), std::make_move_iterator(fam.agg.begin()), std::make_move_iterator(fam.agg.end()));
+    if (!fam.policy.quantiles.empty() && fam.fam.type == prometheus::MetricType::Histogram) {
+      for (auto& m : metric) SketchToSummary(m, fam.policy, sketch_);
+      fam.fam.type = prometheus::MetricType::Summary;
+    }
+    out.push_back(std::move(fam.fam));
+  }
+  fams_.clear();
+  fam_slots_.clear();
+  return out;
+}
+
+} // namespace promkit::mux
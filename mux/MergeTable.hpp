@@ -0,0 +1,90 @@
+// Hash-based merge of worker families for MuxCollector
+#pragma once
+
+#include "FamilyPool.hpp"
+
+#include <prometheus/metric_family.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace promkit::mux {
+
+// How the aggregator publishes one family ([[metrics]] publish / gauge_agg).
+struct MergePolicy {
+  enum class GaugeAgg { Sum, Last, Max };
+  bool per_proc = true;  // keep the per-component series
+  bool aggregate = true; // add component-less series (counters, histograms, gauges)
+  GaugeAgg gauge_agg = GaugeAgg::Sum;
+  // Summaries: workers send their sketches as histograms (see QuantileSketch);
+  // non-empty quantiles turn the merged ones back into summaries. Without them
+  // the quantiles and schema come from the series' sketch marker.
+  std::vector<double> quantiles;
+  int sketch_schema = 0;
+};
+using MergePolicies = std::unordered_map<std::string, MergePolicy>; // full family name -> policy
+
+// Label on every series of a summary's sketch form, "<schema>:<q>,<q>,...",
+// so that the aggregator can turn it back into the summary without a policy.
+inline constexpr std::string_view kSketchLabel = "promkit_sketch";
+std::string SketchMarker(int schema, const std::vector<double>& quantiles);
+// Reads a marker into policy's quantiles and sketch_schema; false (policy
+// untouched) when it is malformed.
+bool ParseSketchMarker(std::string_view marker, MergePolicy& policy);
+
+// type: counter|gauge|histogram|summary; publish: sum_only|per_proc|both;
+// gauge_agg: sum|last|max. Empty values take the type's default: both for
+// counters, histograms and summaries; per_proc for gauges unless gauge_agg is
+// set, then both.
+MergePolicy MakeMergePolicy(std::string_view type, std::string_view publish, std::string_view gauge_agg);
+
+// Concatenates series of families with the same (name, type) across sources
+// and aggregates counter, gauge and histogram series across components: series
+// whose labels match once "component" is dropped fold into one component-less
+// series, appended after the family's per-component series. Families and aggregated
+// series are found through open-addressing tables keyed by precomputed hashes;
+// each aggregated series stores its (sorted, component-less) label set once.
+// Families listed in policies follow their MergePolicy; others get their type's
+// default. Gauge "last" keeps the value of the last source added. Summary
+// sketches merge as histograms and leave Take as summaries, marker label
+// dropped, whether or not policies list them. Merged families and
+// aggregated series are taken from pool when given.
+class MergeTable {
+ public:
+  explicit MergeTable(const MergePolicies* policies = nullptr, FamilyPool* pool = nullptr)
+      : policies_(policies), pool_(pool) {}
+
+  // Moves f's series into the table.
+  void Add(prometheus::MetricFamily&& f);
+  // Merged families in first-seen order; leaves the table empty.
+  std::vector<prometheus::MetricFamily> Take();
+
+ private:
+  struct Slot {
+    std::uint64_t hash = 0;
+    std::uint32_t index = 0; // 1-based; 0 marks an empty slot
+  };
+  struct Family {
+    prometheus::MetricFamily fam;
+    std::vector<prometheus::ClientMetric> agg; // component-less sums
+    std::vector<Slot> agg_slots;
+    MergePolicy policy;
+  };
+
+  Family& FamilyFor(const prometheus::MetricFamily& f);
+  prometheus::ClientMetric& AggregateFor(Family& fam, const prometheus::ClientMetric& m, bool& fresh);
+
+  const MergePolicies* policies_;
+  FamilyPool* pool_;
+  std::vector<Family> fams_;
+  std::vector<Slot> fam_slots_;
+  std::vector<const prometheus::ClientMetric::Label*> key_; // scratch: labels minus component, sorted
+  std::vector<prometheus::ClientMetric::Bucket> buckets_;    // scratch for mismatched bucket merges
+  std::vector<std::pair<double, std::uint64_t>> sketch_;     // scratch: one sketch's (bound, count)
+};
+
+} // namespace promkit::mux
@@ -1,228 +1,199 @@
 ﻿#include "MuxCollector.hpp"
+#include "MergeTable.hpp"
+#include "ShmSegment.hpp"
 #include "TextParser.hpp"
+#include "WorkerDirectory.hpp"
+#include "WorkerFetch.hpp"
 
 #include <prometheus/metric_family.h>
 #include <prometheus/text_serializer.h>
 #include <prometheus/registry.h>
 
-#include <filesystem>
-#include <fstream>
-#include <sstream>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <algorithm>
-#include <unordered_map>
-
-#ifdef _WIN32
-#  include <winsock2.h>
-#  include <ws2tcpip.h>
-#  include <windows.h>
-#else
-#  include <sys/socket.h>
-#  include <arpa/inet.h>
-#  include <unistd.h>
-#  include <signal.h>
-#endif
-
-namespace {
-#ifdef _WIN32
-struct WsaInit { WsaInit(){ WSADATA d; WSAStartup(MAKEWORD(2,2), &d);} ~WsaInit(){ WSACleanup(); } };
-static WsaInit g_wsa_init; // ensure WSA is initialized once
-using socket_t = SOCKET;
-constexpr socket_t invalid_socket = INVALID_SOCKET;
-inline void closesock(socket_t s){ if(s!=INVALID_SOCKET) ::closesocket(s); }
-static bool PidAlive(int pid) {
-  HANDLE h = ::OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
-  if (!h) return false;
-  DWORD code = 0; BOOL ok = ::GetExitCodeProcess(h, &code);
-  ::CloseHandle(h);
-  return ok && code == STILL_ACTIVE;
-}
-#else
-using socket_t = int;
-constexpr socket_t invalid_socket = -1;
-inline void closesock(socket_t s){ if(s>=0) ::close(s); }
-static bool PidAlive(int pid) { return ::kill(pid, 0) == 0; }
-#endif
-} // anonymous
-
-namespace fs = std::filesystem;
 
 namespace promkit::mux {
 
-void MuxCollector::SetDirectory(std::string dir) { dir_ = std::move(dir); }
+MuxCollector::MuxCollector() = default;
+MuxCollector::~MuxCollector() = default;
+
+void MuxCollector::SetDirectory(std::string dir) {
+  std::lock_guard<std::mutex> lk(mu_);
+  dir_ = std::move(dir);
+  watch_.reset();
+}
 void MuxCollector::SetWorkers(std::vector<WorkerEndpoint> workers) { workers_ = std::move(workers); }
-void MuxCollector::SetSelf(std::shared_ptr<prometheus::Registry> self, std::string component) {
+void MuxCollector::SetSelf(std::shared_ptr<prometheus::Collectable> self, std::string component) {
   self_ = std::move(self);
   self_component_ = std::move(component);
 }
-
-static std::vector<WorkerEndpoint> ScanDir(const std::string& dir) {
-  std::vector<WorkerEndpoint> out;
-  if (dir.empty()) return out;
-  std::error_code ec;
-  if (!fs::exists(dir, ec)) return out;
-  for (auto& de : fs::directory_iterator(dir, ec)) {
-    if (!de.is_regular_file()) continue;
-    // File format: endpoint host:port\ncomponent <name>\npid <pid>\npath /metrics
-    std::ifstream ifs(de.path());
-    if (!ifs) continue;
-    WorkerEndpoint we; we.host = "127.0.0.1"; we.port = 0; we.path = "/metrics";
-    std::string line;
-    while (std::getline(ifs, line)) {
-      if (line.starts_with("endpoint ")) {
-        auto e = line.substr(9);
-        auto colon = e.find(':');
-        if (colon != std::string::npos) { we.host = e.substr(0, colon); we.port = std::stoi(e.substr(colon+1)); }
-      } else if (line.starts_with("component ")) {
-        we.component = line.substr(10);
-      } else if (line.starts_with("pid ")) {
-        we.pid = std::stoi(line.substr(4));
-      } else if (line.starts_with("path ")) {
-        we.path = line.substr(5);
-      }
-    }
-    // Prune stale descriptor: pid not alive
-    if (we.pid > 0) {
-      if (!PidAlive(we.pid)) {
-        std::error_code ec2; fs::remove(de.path(), ec2);
-        continue;
-      }
-    }
-    if (we.port > 0 && !we.component.empty()) out.push_back(std::move(we));
-  }
-  return out;
+void MuxCollector::SetTimeouts(std::chrono::milliseconds per_worker, std::chrono::milliseconds budget) {
+  per_worker_ = per_worker;
+  budget_ = budget;
+}
+void MuxCollector::SetPolicies(MergePolicies policies) {
+  auto p = std::make_shared<const MergePolicies>(std::move(policies));
+  std::lock_guard<std::mutex> lk(mu_);
+  policies_ = std::move(p);
 }
 
-static std::string HttpGetLocal(const WorkerEndpoint& we) {
-  // Very naive: use std::ifstream on /proc/self/fd? No.
-  // For initial version, we rely on curl-like availability is not guaranteed.
-  // So we use a minimal blocking socket HTTP/1.0 GET.
-  // Note: this is intentionally simple and localhost-only.
-  std::ostringstream out;
+void MuxCollector::SetCacheWindow(std::chrono::milliseconds window) { snapshot_.SetWindow(window); }
+void MuxCollector::SetSelfMetrics(bool on) { self_metrics_ = on; }
+void MuxCollector::SetLabels(std::map<std::string, std::string> labels) { labels_ = std::move(labels); }
+
+MuxCollector::Merged::~Merged() {
+  if (!spares) return; // moved from
   try {
-    socket_t sock = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == invalid_socket) return {};
-    sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_port = htons(we.port);
-    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // 127.0.0.1
-    if (::connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) { closesock(sock); return {}; }
-    std::string req = "GET " + we.path + " HTTP/1.0\r\nHost: " + we.host + "\r\nConnection: close\r\n\r\n";
-    ::send(sock, req.data(), (int)req.size(), 0);
-    char buf[4096];
-    std::string resp;
-    int n;
-    while ((n = ::recv(sock, buf, (int)sizeof(buf), 0)) > 0) resp.append(buf, buf + n);
-    closesock(sock);
-    // strip headers
-    auto pos = resp.find("\r\n\r\n");
-    if (pos != std::string::npos) resp = resp.substr(pos + 4);
-    return resp;
+    std::lock_guard<std::mutex> lk(spares->mu);
+    // One merge's worth is enough: a later merge takes the pool whole
+    if (spares->pool.empty()) spares->pool.Recycle(std::move(fams));
   } catch (...) {
-    return {};
   }
 }
 
-std::vector<prometheus::MetricFamily> MuxCollector::Collect() const {
+std::vector<prometheus::MetricFamily> MuxCollector::Collect() const { return *Snapshot(); }
+
+std::shared_ptr<const std::vector<prometheus::MetricFamily>> MuxCollector::Snapshot() const {
+  auto merged = snapshot_.Get([this] { return Merge(); });
+  return {merged, &merged->fams};
+}
+
+MuxCollector::Merged MuxCollector::Merge() const {
   std::vector<WorkerEndpoint> ws = workers_;
-  if (ws.empty() && !dir_.empty()) ws = ScanDir(dir_);
-  // Merge by family name/type: append series across workers
-  std::vector<prometheus::MetricFamily> merged;
-  auto findFam = [&](const std::string& name, prometheus::MetricType ty) -> prometheus::MetricFamily* {
-    for (auto& f : merged) if (f.name == name && f.type == ty) return &f;
-    merged.push_back({});
-    merged.back().name = name; merged.back().type = ty; return &merged.back();
-  };
+  if (ws.empty()) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!dir_.empty()) {
+      if (!watch_) watch_ = std::make_unique<WorkerDirectory>(dir_);
+      ws = watch_->Workers();
+    }
+  }
+  // Merge by family name/type: append series across workers, aggregating across
+  // components as they arrive, per the publish/gauge_agg policies
+  std::shared_ptr<const MergePolicies> policies;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    policies = policies_;
+  }
+  FamilyPool pool;
+  {
+    std::lock_guard<std::mutex> lk(spares_->mu);
+    std::swap(pool, spares_->pool);
+  }
+  MergeTable table(policies.get(), &pool);
   // 先收集 aggregator 自身 registry 的指标（labels.component 已由库注入，不再重复注入）
   if (auto self = self_.lock()) {
-    auto self_fams = self->Collect();
-    for (auto& f : self_fams) {
-      auto* dst = findFam(f.name, f.type);
-      if (dst->help.empty() && !f.help.empty()) dst->help = f.help;
-      dst->metric.insert(dst->metric.end(), std::make_move_iterator(f.metric.begin()), std::make_move_iterator(f.metric.end()));
-    }
+    for (auto& f : self->Collect()) table.Add(std::move(f));
   }
-  for (const auto& w : ws) {
-    auto text = HttpGetLocal(w);
-    if (text.empty()) continue;
-    auto fams = ParseTextExposition(text);
-    for (auto& f : fams) {
-      auto* dst = findFam(f.name, f.type);
-      // Keep first non-empty help
-      if (dst->help.empty() && !f.help.empty()) dst->help = f.help;
-      // Append series
-      dst->metric.insert(dst->metric.end(), std::make_move_iterator(f.metric.begin()), std::make_move_iterator(f.metric.end()));
+  // shm workers are asked for a fresh image first and publish while the HTTP
+  // workers are fetched all at once, bounded by per-worker deadlines and the scrape budget
+  const auto shm_deadline = std::chrono::steady_clock::now() + per_worker_;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::erase_if(shm_readers_, [&](const auto& kv) {
+      return std::none_of(ws.begin(), ws.end(), [&](const WorkerEndpoint& w) { return w.shm == kv.first; });
+    });
+    for (const auto& w : ws) {
+      if (!w.shm.empty()) shm_readers_[w.shm].Request(w.shm);
     }
   }
-      // 聚合 histogram
-  // 按 (labels - component) 进行汇总
-  auto labelKeyWithoutComponent = [](const std::vector<prometheus::ClientMetric::Label>& labs) {
-    std::vector<prometheus::ClientMetric::Label> v;
-    v.reserve(labs.size());
-    for (const auto& l : labs) if (l.name != "component") v.push_back(l);
-    std::sort(v.begin(), v.end());
-    std::string key;
-    for (size_t i=0;i<v.size();++i) {
-      if (i) key.push_back('|');
-      key.append(v[i].name); key.push_back('='); key.append(v[i].value);
+  auto fetched = FetchWorkers(ws, per_worker_, budget_);
+  std::vector<double> parse_secs(ws.size()), bytes(ws.size());
+  std::unique_lock shm_lock(mu_);
+  for (size_t wi = 0; wi < ws.size(); ++wi) {
+    const auto& w = ws[wi];
+    auto& res = fetched[wi];
+    std::vector<prometheus::MetricFamily> fams;
+    if (!w.shm.empty()) {
+      const auto t0 = std::chrono::steady_clock::now();
+      auto& reader = shm_readers_[w.shm];
+      res.ok = reader.Read(w.shm, fams, &pool, shm_deadline);
+      res.timed_out = reader.timed_out();
+      res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      if (!res.ok) continue;
+      parse_secs[wi] = res.seconds - reader.last_wait_seconds(); // the copy and decode
+      bytes[wi] = static_cast<double>(reader.last_bytes());
+    } else {
+      if (!res.ok || res.body.empty()) continue;
+      const auto t0 = std::chrono::steady_clock::now();
+      fams = ParseTextExposition(res.body, &pool);
+      parse_secs[wi] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      bytes[wi] = static_cast<double>(res.body.size());
     }
-    return key;
-  };
+    for (auto& f : fams) table.Add(std::move(f));
+  }
+  shm_lock.unlock();
+  auto merged = table.Take();
 
-  auto ensureFam = [&](const std::string& name, prometheus::MetricType ty, const std::string& help) -> prometheus::MetricFamily& {
-    for (auto& f : merged) if (f.name == name && f.type == ty) return f;
-    merged.push_back({});
-    merged.back().name = name; merged.back().type = ty; merged.back().help = help; return merged.back();
+  // Global labels, with component set to the worker's (empty: ours)
+  auto labelsFor = [&](const std::string& component) {
+    std::vector<prometheus::ClientMetric::Label> out;
+    out.reserve(labels_.size() + 1);
+    bool placed = component.empty();
+    for (const auto& [k, v] : labels_) {
+      if (!placed && k >= "component") {
+        out.push_back({"component", component});
+        placed = true;
+        if (k == "component") continue;
+      }
+      out.push_back({k, v});
+    }
+    if (!placed) out.push_back({"component", component});
+    return out;
   };
 
-  for (const auto& f : std::as_const(merged)) {
-    if (f.type == prometheus::MetricType::Histogram) {
-      // 聚合 histogram
-      std::unordered_map<std::string, prometheus::ClientMetric> agg; // key -> aggregated metric
-      for (const auto& m : f.metric) {
-        auto key = labelKeyWithoutComponent(m.label);
-        auto& dst = agg[key];
-        if (dst.label.empty()) {
-          // 初始化标签（去除 component）
-          for (const auto& l : m.label) if (l.name != "component") dst.label.push_back(l);
-        }
-        dst.histogram.sample_count += m.histogram.sample_count;
-        dst.histogram.sample_sum += m.histogram.sample_sum;
-        // 按 upper_bound 汇总桶
-        for (const auto& b : m.histogram.bucket) {
-          bool found=false;
-          for (auto& db : dst.histogram.bucket) {
-            if (db.upper_bound == b.upper_bound) { db.cumulative_count += b.cumulative_count; found=true; break; }
-          }
-          if (!found) {
-            prometheus::ClientMetric::Bucket nb; nb.upper_bound = b.upper_bound; nb.cumulative_count = b.cumulative_count; dst.histogram.bucket.push_back(nb);
-          }
-        }
-      }
-      // 输出到 merged（family 同名，同类型；不移除原明细）
-      auto& outFam = ensureFam(f.name, f.type, f.help);
-      for (auto& kv : agg) {
-        auto m = std::move(kv.second);
-        std::sort(m.histogram.bucket.begin(), m.histogram.bucket.end(), [](auto& a, auto& b){ return a.upper_bound < b.upper_bound; });
-        outFam.metric.push_back(std::move(m));
-      }
-    } else if (f.type == prometheus::MetricType::Counter) {
-       // 聚合 counter（或按 _total 规则的 untyped）
-      std::unordered_map<std::string, prometheus::ClientMetric> agg;
-      for (const auto& m : f.metric) {
-        auto key = labelKeyWithoutComponent(m.label);
-        auto& dst = agg[key];
-        if (dst.label.empty()) {
-          for (const auto& l : m.label) if (l.name != "component") dst.label.push_back(l);
-        }
-        dst.counter.value += m.counter.value;
-      }
-      auto& outFam = ensureFam(f.name, f.type, f.help);
-      for (auto& kv : agg) outFam.metric.push_back(std::move(kv.second));
+  // Fetch health per worker (after the merge so these are not summed across components)
+  prometheus::MetricFamily up{"promkit_mux_worker_up", "1 if the last fetch of the worker succeeded", prometheus::MetricType::Gauge, {}};
+  prometheus::MetricFamily secs{"promkit_mux_worker_fetch_seconds", "Duration of the last fetch of the worker", prometheus::MetricType::Gauge, {}};
+  prometheus::MetricFamily tos{"promkit_mux_worker_timeouts_total", "Worker fetches that hit their deadline", prometheus::MetricType::Counter, {}};
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::erase_if(timeouts_, [&](const auto& kv) {
+      return std::none_of(ws.begin(), ws.end(), [&](const WorkerEndpoint& w) { return w.component == kv.first; });
+    });
+    for (size_t wi = 0; wi < ws.size(); ++wi) {
+      const auto& res = fetched[wi];
+      if (res.timed_out) timeouts_[ws[wi].component] += 1;
+      prometheus::ClientMetric m;
+      m.label = labelsFor(ws[wi].component);
+      m.gauge.value = res.ok ? 1 : 0;
+      up.metric.push_back(m);
+      m.gauge.value = res.seconds;
+      secs.metric.push_back(m);
+      m.gauge.value = 0;
+      m.counter.value = timeouts_[ws[wi].component];
+      tos.metric.push_back(std::move(m));
+    }
+  }
+  if (!ws.empty()) {
+    merged.push_back(std::move(up));
+    merged.push_back(std::move(secs));
+    merged.push_back(std::move(tos));
+  }
+  if (self_metrics_) {
+    prometheus::MetricFamily live{"promkit_mux_workers", "Workers in the mux directory at the last merge", prometheus::MetricType::Gauge, {}};
+    prometheus::MetricFamily nbytes{"promkit_mux_worker_fetch_bytes", "Exposition bytes read in the last fetch of the worker", prometheus::MetricType::Gauge, {}};
+    prometheus::MetricFamily parse{"promkit_mux_worker_parse_seconds", "Time spent decoding the last fetch of the worker", prometheus::MetricType::Gauge, {}};
+    auto& total = live.metric.emplace_back();
+    total.label = labelsFor({});
+    total.gauge.value = static_cast<double>(ws.size());
+    for (size_t wi = 0; wi < ws.size(); ++wi) {
+      prometheus::ClientMetric m;
+      m.label = labelsFor(ws[wi].component);
+      m.gauge.value = bytes[wi];
+      nbytes.metric.push_back(m);
+      m.gauge.value = parse_secs[wi];
+      parse.metric.push_back(std::move(m));
+    }
+    merged.push_back(std::move(live));
+    if (!ws.empty()) {
+      merged.push_back(std::move(nbytes));
+      merged.push_back(std::move(parse));
     }
   }
 
-  return merged;
+  return Merged(std::move(merged), spares_);
 }
 
 } // namespace promkit::mux
@@ -1,16 +1,21 @@
 // MuxCollector: a Collectable that scrapes multiple worker endpoints and merges
 #pragma once
 
+#include "FamilyPool.hpp"
+#include "FreshCache.hpp"
+#include "MergeTable.hpp"
+#include "ShmSegment.hpp"
+
 #include <prometheus/collectable.h>
 #include <prometheus/metric_family.h>
 
+#include <chrono>
+#include <map>
 #include <mutex>
 #include <memory>
 #include <string>
 #include <vector>
 
-namespace prometheus { class Registry; }
-
 namespace promkit::mux {
 
 struct WorkerEndpoint {
@@ -20,28 +25,78 @@ struct WorkerEndpoint {
   // labels to inject for per-proc view
   std::string component;    // component distinguisher (from labels.component)
   int         pid = 0; // kept for future debugging; not exported as label
+  std::string shm;     // shared-memory segment path; when set, read instead of HTTP
 };
 
 // Very small HTTP getter using civetweb client API would be ideal, but to keep
 // this minimal and portable within current repo, we will delegate the actual
 // fetching to the exposer server by using prometheus-cpp primitives is not possible.
 // Here we only declare the interface. Implementation uses a naive TCP fetch (optional).
+class WorkerDirectory;
+
 class MuxCollector : public prometheus::Collectable {
  public:
-  MuxCollector() = default;
-  // Directory to scan worker descriptors, e.g. /tmp/promkit-mux/ns_component
+  MuxCollector();
+  ~MuxCollector() override;
+  // Directory of worker descriptors, e.g. /tmp/promkit-mux/ns_component; watched, not rescanned per scrape
   void SetDirectory(std::string dir);
   // Optional static workers set (tests). When non-empty, directory is ignored.
   void SetWorkers(std::vector<WorkerEndpoint> workers);
-  // Include aggregator's own registry into per-component merge
-  void SetSelf(std::shared_ptr<prometheus::Registry> self, std::string component);
+  // Include aggregator's own metrics (registry or a wrapper around it) into per-component merge
+  void SetSelf(std::shared_ptr<prometheus::Collectable> self, std::string component);
+  // HTTP workers are fetched concurrently; each gets per_worker, the whole scrape budget.
+  void SetTimeouts(std::chrono::milliseconds per_worker, std::chrono::milliseconds budget);
+  // Per-family publish/gauge_agg policies (by full family name); may be replaced while serving.
+  void SetPolicies(MergePolicies policies);
+  // A merge younger than window is returned again instead of scraping the workers;
+  // concurrent Collects always share one merge. 0 (default): every Collect merges.
+  void SetCacheWindow(std::chrono::milliseconds window);
+  // Global labels ([labels]) of the families the collector adds itself; the
+  // per-worker ones take the worker's component instead of ours.
+  void SetLabels(std::map<std::string, std::string> labels);
+  // Also expose promkit_mux_workers, promkit_mux_worker_fetch_bytes and
+  // promkit_mux_worker_parse_seconds (exporter.self_metrics).
+  void SetSelfMetrics(bool on);
+  // Besides the merged families, exposes per-component fetch health:
+  // promkit_mux_worker_up, promkit_mux_worker_fetch_seconds, promkit_mux_worker_timeouts_total.
   std::vector<prometheus::MetricFamily> Collect() const override;
+  // What Collect returns, shared instead of copied. The storage of a merge is
+  // reused by a later one once every holder has let go of it.
+  std::shared_ptr<const std::vector<prometheus::MetricFamily>> Snapshot() const;
 
  private:
+  struct Spares {
+    std::mutex mu;
+    FamilyPool pool; // storage of the last merge released, for the next one to build into
+  };
+  // A merge as cached; hands its families to spares when destroyed.
+  struct Merged {
+    std::vector<prometheus::MetricFamily> fams;
+    std::shared_ptr<Spares> spares;
+    Merged(std::vector<prometheus::MetricFamily> f, std::shared_ptr<Spares> s) : fams(std::move(f)), spares(std::move(s)) {}
+    Merged(Merged&&) = default;
+    ~Merged();
+  };
+
+  Merged Merge() const;
+
   std::vector<WorkerEndpoint> workers_;
   std::string dir_;
-  std::weak_ptr<prometheus::Registry> self_;
+  std::weak_ptr<prometheus::Collectable> self_;
   std::string self_component_;
+  std::chrono::milliseconds per_worker_{2000};
+  std::chrono::milliseconds budget_{8000};
+  bool self_metrics_ = false;
+  std::map<std::string, std::string> labels_;
+  mutable std::mutex mu_;
+  // component -> fetches that hit a deadline, for components of the last merge (under mu_)
+  mutable std::map<std::string, double> timeouts_;
+  // shm segment path -> reader caching that worker's schema (under mu_)
+  mutable std::map<std::string, ShmReader> shm_readers_;
+  std::shared_ptr<const MergePolicies> policies_; // under mu_
+  mutable std::unique_ptr<WorkerDirectory> watch_; // worker table of dir_ (under mu_)
+  std::shared_ptr<Spares> spares_ = std::make_shared<Spares>();
+  mutable FreshCache<Merged> snapshot_; // last merge
 };
 
 } // namespace promkit::mux
@@ -0,0 +1,483 @@
+#include "ShmSegment.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+#ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <time.h>
+#endif
+
+namespace promkit::mux {
+
+namespace {
+
+constexpr char kMagic[8] = {'P', 'K', 'S', 'H', 'M', '3', 0, 0};
+
+// Start of every segment, followed by [schema][values]. seq is a seqlock
+// counter: odd while the writer is rewriting the payload, bumped to the next
+// even value once it is complete. generation changes whenever the schema does,
+// so a reader holding that generation only needs the values. It starts from a
+// random value on every Open: a segment re-created at the same path (worker
+// re-Init, pid reuse) never repeats a generation a reader has cached. A reader
+// bumps request to ask for a fresh image; the writer publishes one and sets
+// served to the request it saw before collecting.
+struct alignas(64) SegmentHeader {
+  char magic[8];
+  std::uint32_t layout; // sizeof(SegmentHeader): rejects segments of another build
+  std::int32_t pid;
+  char component[112];
+  std::atomic<std::uint64_t> seq;
+  std::atomic<std::uint64_t> generation;
+  std::atomic<std::uint64_t> schema_size; // bytes of schema after the header
+  std::atomic<std::uint64_t> values_size; // bytes of values after the schema
+  std::atomic<std::uint32_t> request;     // futex word, bumped by readers
+  std::atomic<std::uint32_t> served;      // futex word, the request the image answers
+};
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "seqlock words are shared across processes");
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free && sizeof(std::atomic<std::uint32_t>) == 4,
+              "futex words are plain 32-bit integers");
+constexpr std::size_t kPayloadOffset = sizeof(SegmentHeader);
+constexpr std::size_t kMinSegment = 64 * 1024;
+constexpr int kReadAttempts = 8;
+
+// Encoding: strings are u32 length + bytes, numbers are raw native values.
+template <typename T>
+void Put(std::string& out, T v) {
+  out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+void PutStr(std::string& out, const std::string& s) {
+  Put<std::uint32_t>(out, static_cast<std::uint32_t>(s.size()));
+  out.append(s);
+}
+
+struct Reader {
+  std::string_view in;
+  bool ok = true;
+
+  template <typename T>
+  T Get() {
+    T v{};
+    if (in.size() < sizeof(T)) { ok = false; return v; }
+    std::memcpy(&v, in.data(), sizeof(T));
+    in.remove_prefix(sizeof(T));
+    return v;
+  }
+  std::string GetStr() {
+    const auto n = Get<std::uint32_t>();
+    if (!ok || in.size() < n) { ok = false; return {}; }
+    std::string s(in.substr(0, n));
+    in.remove_prefix(n);
+    return s;
+  }
+  // Element count that cannot exceed what is left to read.
+  std::uint32_t GetCount(std::size_t min_elem_size) {
+    const auto n = Get<std::uint32_t>();
+    if (ok && static_cast<std::uint64_t>(n) * min_elem_size > in.size()) ok = false;
+    return ok ? n : 0;
+  }
+};
+
+#ifndef _WIN32
+// Blocks while word holds expected, for at most timeout. The word is mapped by
+// other processes, so the futex is a shared one; elsewhere it is polled.
+void WaitWord(const std::atomic<std::uint32_t>& word, std::uint32_t expected, std::chrono::nanoseconds timeout) {
+  if (timeout <= std::chrono::nanoseconds::zero()) return;
+#ifdef __linux__
+  const auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+  timespec ts{};
+  ts.tv_sec = static_cast<time_t>(secs.count());
+  ts.tv_nsec = static_cast<long>((timeout - secs).count());
+  ::syscall(SYS_futex, const_cast<std::atomic<std::uint32_t>*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+  const auto end = std::chrono::steady_clock::now() + timeout;
+  while (word.load(std::memory_order_acquire) == expected && std::chrono::steady_clock::now() < end) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+#endif
+}
+
+void WakeWord(std::atomic<std::uint32_t>& word) {
+#ifdef __linux__
+  ::syscall(SYS_futex, &word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+#endif
+
+// First generation of a segment: random, never 0 (a reader's "nothing cached").
+std::uint64_t GenerationSeed() {
+  std::uint64_t seed = 0;
+  try {
+    std::random_device rd;
+    seed = (static_cast<std::uint64_t>(rd()) << 32) ^ rd();
+  } catch (...) {
+  }
+  seed ^= static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) * 0x9e3779b97f4a7c15ull;
+  return seed | 1;
+}
+
+} // namespace
+
+// Schema: per family name, help, type and series count; per series its labels
+// and, for histograms/summaries, the bucket bounds or quantiles.
+void EncodeSchema(const std::vector<prometheus::MetricFamily>& fams, std::string& out) {
+  using prometheus::MetricType;
+  out.clear();
+  Put<std::uint32_t>(out, static_cast<std::uint32_t>(fams.size()));
+  for (const auto& f : fams) {
+    PutStr(out, f.name);
+    PutStr(out, f.help);
+    Put<std::uint8_t>(out, static_cast<std::uint8_t>(f.type));
+    Put<std::uint32_t>(out, static_cast<std::uint32_t>(f.metric.size()));
+    for (const auto& m : f.metric) {
+      Put<std::uint32_t>(out, static_cast<std::uint32_t>(m.label.size()));
+      for (const auto& l : m.label) {
+        PutStr(out, l.name);
+        PutStr(out, l.value);
+      }
+      if (f.type == MetricType::Histogram) {
+        Put<std::uint32_t>(out, static_cast<std::uint32_t>(m.histogram.bucket.size()));
+        for (const auto& b : m.histogram.bucket) Put(out, b.upper_bound);
+      } else if (f.type == MetricType::Summary) {
+        Put<std::uint32_t>(out, static_cast<std::uint32_t>(m.summary.quantile.size()));
+        for (const auto& q : m.summary.quantile) Put(out, q.quantile);
+      }
+    }
+  }
+}
+
+// Values: one 8-byte word per scalar series; count, sum and one word per
+// bucket/quantile for histograms/summaries, in schema order.
+void EncodeValues(const std::vector<prometheus::MetricFamily>& fams, std::string& out) {
+  using prometheus::MetricType;
+  out.clear();
+  for (const auto& f : fams) {
+    for (const auto& m : f.metric) {
+      switch (f.type) {
+        case MetricType::Counter: Put(out, m.counter.value); break;
+        case MetricType::Gauge: Put(out, m.gauge.value); break;
+        case MetricType::Info: Put(out, m.info.value); break;
+        case MetricType::Untyped: Put(out, m.untyped.value); break;
+        case MetricType::Summary:
+          Put(out, m.summary.sample_count);
+          Put(out, m.summary.sample_sum);
+          for (const auto& q : m.summary.quantile) Put(out, q.value);
+          break;
+        case MetricType::Histogram:
+          Put(out, m.histogram.sample_count);
+          Put(out, m.histogram.sample_sum);
+          for (const auto& b : m.histogram.bucket) Put(out, b.cumulative_count);
+          break;
+      }
+    }
+  }
+}
+
+bool DecodeSchema(std::string_view in, std::vector<prometheus::MetricFamily>& out) {
+  using prometheus::MetricType;
+  out.clear();
+  Reader r{in};
+  const auto nfam = r.GetCount(13);
+  out.reserve(nfam);
+  for (std::uint32_t i = 0; i < nfam && r.ok; ++i) {
+    auto& f = out.emplace_back();
+    f.name = r.GetStr();
+    f.help = r.GetStr();
+    const auto ty = r.Get<std::uint8_t>();
+    if (ty > static_cast<std::uint8_t>(MetricType::Info)) return false;
+    f.type = static_cast<MetricType>(ty);
+    const auto nm = r.GetCount(4);
+    f.metric.resize(nm);
+    for (auto& m : f.metric) {
+      const auto nl = r.GetCount(8);
+      m.label.resize(nl);
+      for (auto& l : m.label) {
+        l.name = r.GetStr();
+        l.value = r.GetStr();
+      }
+      if (f.type == MetricType::Histogram) {
+        m.histogram.bucket.resize(r.GetCount(8));
+        for (auto& b : m.histogram.bucket) b.upper_bound = r.Get<double>();
+      } else if (f.type == MetricType::Summary) {
+        m.summary.quantile.resize(r.GetCount(8));
+        for (auto& q : m.summary.quantile) q.quantile = r.Get<double>();
+      }
+    }
+  }
+  return r.ok && r.in.empty();
+}
+
+bool ApplyValues(std::string_view in, std::vector<prometheus::MetricFamily>& fams) {
+  using prometheus::MetricType;
+  Reader r{in};
+  for (auto& f : fams) {
+    for (auto& m : f.metric) {
+      switch (f.type) {
+        case MetricType::Counter: m.counter.value = r.Get<double>(); break;
+        case MetricType::Gauge: m.gauge.value = r.Get<double>(); break;
+        case MetricType::Info: m.info.value = r.Get<double>(); break;
+        case MetricType::Untyped: m.untyped.value = r.Get<double>(); break;
+        case MetricType::Summary:
+          m.summary.sample_count = r.Get<std::uint64_t>();
+          m.summary.sample_sum = r.Get<double>();
+          for (auto& q : m.summary.quantile) q.value = r.Get<double>();
+          break;
+        case MetricType::Histogram:
+          m.histogram.sample_count = r.Get<std::uint64_t>();
+          m.histogram.sample_sum = r.Get<double>();
+          for (auto& b : m.histogram.bucket) b.cumulative_count = r.Get<std::uint64_t>();
+          break;
+      }
+      if (!r.ok) return false;
+    }
+  }
+  return r.in.empty();
+}
+
+#ifndef _WIN32
+
+ShmWriter::~ShmWriter() { Close(); }
+
+bool ShmWriter::Open(const std::string& path, const std::string& component, int pid) {
+  Close();
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) return false;
+  path_ = path;
+  if (!Reserve(kMinSegment - kPayloadOffset)) {
+    Close();
+    return false;
+  }
+  auto* h = reinterpret_cast<SegmentHeader*>(base_);
+  std::memcpy(h->magic, kMagic, sizeof(kMagic));
+  h->layout = static_cast<std::uint32_t>(sizeof(SegmentHeader));
+  h->pid = pid;
+  const auto n = std::min(component.size(), sizeof(h->component) - 1);
+  std::memcpy(h->component, component.data(), n);
+  h->component[n] = '\0';
+  h->generation.store(GenerationSeed(), std::memory_order_relaxed);
+  // seq stays 0 (never published) until the first Publish; request and served start at 0
+  served_ = answer_ = 0;
+  return true;
+}
+
+bool ShmWriter::WaitForRequest(std::chrono::milliseconds timeout) {
+  if (!base_) return false;
+  auto* h = reinterpret_cast<SegmentHeader*>(base_);
+  auto req = h->request.load(std::memory_order_acquire);
+  if (req == served_) {
+    WaitWord(h->request, req, timeout);
+    req = h->request.load(std::memory_order_acquire);
+  }
+  if (req == served_) return false;
+  answer_ = req; // requests arriving from here on wait for the next image
+  return true;
+}
+
+void ShmWriter::Interrupt() {
+  if (base_) WakeWord(reinterpret_cast<SegmentHeader*>(base_)->request);
+}
+
+bool ShmWriter::Reserve(std::size_t payload) {
+  const std::size_t need = kPayloadOffset + payload;
+  if (need <= mapped_) return true;
+  const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  std::size_t size = std::max({need, mapped_ * 2, kMinSegment});
+  size = (size + page - 1) / page * page;
+  // Grow only: readers holding the old, shorter mapping stay valid and remap
+  // once they see a payload past their end.
+  if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) return false;
+  void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (p == MAP_FAILED) return false;
+  if (base_) ::munmap(base_, mapped_);
+  base_ = static_cast<unsigned char*>(p);
+  mapped_ = size;
+  return true;
+}
+
+bool ShmWriter::Publish(const std::vector<prometheus::MetricFamily>& fams) {
+  if (!base_) return false;
+  try {
+    EncodeSchema(fams, next_schema_);
+    EncodeValues(fams, values_);
+  } catch (...) {
+    return false;
+  }
+  const bool same_schema = !schema_.empty() && next_schema_ == schema_;
+  if (!Reserve(next_schema_.size() + values_.size())) return false;
+  auto* h = reinterpret_cast<SegmentHeader*>(base_);
+  const auto s = h->seq.load(std::memory_order_relaxed);
+  h->seq.store(s + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  if (!same_schema) {
+    schema_.swap(next_schema_);
+    std::memcpy(base_ + kPayloadOffset, schema_.data(), schema_.size());
+    h->schema_size.store(schema_.size(), std::memory_order_relaxed);
+    h->generation.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Steady state: the schema is already in place and only the values move
+  std::memcpy(base_ + kPayloadOffset + schema_.size(), values_.data(), values_.size());
+  h->values_size.store(values_.size(), std::memory_order_relaxed);
+  h->seq.store(s + 2, std::memory_order_release);
+  served_ = answer_;
+  h->served.store(served_, std::memory_order_release);
+  WakeWord(h->served);
+  return true;
+}
+
+void ShmWriter::Close() {
+  if (base_) ::munmap(base_, mapped_);
+  base_ = nullptr;
+  mapped_ = 0;
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+  if (!path_.empty()) ::unlink(path_.c_str());
+  path_.clear();
+  schema_.clear();
+}
+
+bool ShmReader::Request(const std::string& path) {
+  requested_ = false;
+  const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st{};
+  void* p = MAP_FAILED;
+  if (::fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= kPayloadOffset) {
+    p = ::mmap(nullptr, kPayloadOffset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (p == MAP_FAILED) return false;
+  auto* h = static_cast<SegmentHeader*>(p);
+  if (std::memcmp(h->magic, kMagic, sizeof(kMagic)) == 0 && h->layout == sizeof(SegmentHeader)) {
+    request_ = h->request.fetch_add(1, std::memory_order_acq_rel) + 1;
+    WakeWord(h->request);
+    requested_ = true;
+  }
+  ::munmap(p, kPayloadOffset);
+  return requested_;
+}
+
+bool ShmReader::Read(const std::string& path, std::vector<prometheus::MetricFamily>& out, FamilyPool* pool,
+                     std::chrono::steady_clock::time_point deadline) {
+  using Clock = std::chrono::steady_clock;
+  const bool requested = std::exchange(requested_, false);
+  timed_out_ = false;
+  wait_seconds_ = 0;
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  const unsigned char* base = nullptr;
+  std::size_t size = 0;
+  auto map = [&] {
+    if (base) ::munmap(const_cast<unsigned char*>(base), size);
+    base = nullptr;
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < kPayloadOffset) return false;
+    size = static_cast<std::size_t>(st.st_size);
+    void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return false;
+    base = static_cast<const unsigned char*>(p);
+    return true;
+  };
+
+  bool ok = false;
+  std::uint64_t gen = 0;
+  std::size_t schema_bytes = 0; // 0: the cached schema is current
+  if (map()) {
+    const auto* h = reinterpret_cast<const SegmentHeader*>(base);
+    if (std::memcmp(h->magic, kMagic, sizeof(kMagic)) == 0 && h->layout == sizeof(SegmentHeader)) {
+      // Wait for the image answering our request; past the deadline take the latest
+      const auto t0 = Clock::now();
+      for (auto now = t0; requested; now = Clock::now()) {
+        const auto served = h->served.load(std::memory_order_acquire);
+        if (static_cast<std::int32_t>(served - request_) >= 0) break;
+        if (now >= deadline) {
+          timed_out_ = true;
+          break;
+        }
+        WaitWord(h->served, served, deadline - now);
+      }
+      wait_seconds_ = std::chrono::duration<double>(Clock::now() - t0).count();
+      for (int attempt = 0; attempt < kReadAttempts && !ok; ++attempt) {
+        const auto s1 = h->seq.load(std::memory_order_acquire);
+        if (s1 == 0) break; // nothing published yet
+        if (s1 & 1) {
+          std::this_thread::yield();
+          continue;
+        }
+        gen = h->generation.load(std::memory_order_relaxed);
+        const auto ns = h->schema_size.load(std::memory_order_relaxed);
+        const auto nv = h->values_size.load(std::memory_order_relaxed);
+        if (kPayloadOffset + ns + nv > size) {
+          // the writer grew the segment after we mapped it
+          if (!map()) break;
+          h = reinterpret_cast<const SegmentHeader*>(base);
+          continue;
+        }
+        const auto* payload = reinterpret_cast<const char*>(base + kPayloadOffset);
+        if (gen == generation_) {
+          schema_bytes = 0;
+          image_.assign(payload + ns, nv);
+        } else {
+          schema_bytes = ns;
+          image_.assign(payload, ns + nv);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        ok = h->seq.load(std::memory_order_relaxed) == s1;
+      }
+    }
+  }
+  if (base) ::munmap(const_cast<unsigned char*>(base), size);
+  ::close(fd);
+  if (!ok) return false;
+  try {
+    const std::string_view image(image_);
+    if (gen != generation_) {
+      generation_ = 0;
+      if (!DecodeSchema(image.substr(0, schema_bytes), schema_)) return false;
+      generation_ = gen;
+    }
+    if (pool) pool->Assign(schema_, out);
+    else out = schema_;
+    if (ApplyValues(image.substr(schema_bytes), out)) return true;
+    generation_ = 0; // values that do not fit the cached schema: decode it again next time
+    return false;
+  } catch (...) {
+    generation_ = 0;
+    return false;
+  }
+}
+
+#else // _WIN32: no shared-memory transport yet; workers stay on HTTP
+
+ShmWriter::~ShmWriter() = default;
+bool ShmWriter::Open(const std::string&, const std::string&, int) { return false; }
+bool ShmWriter::Reserve(std::size_t) { return false; }
+bool ShmWriter::WaitForRequest(std::chrono::milliseconds) { return false; }
+void ShmWriter::Interrupt() {}
+bool ShmWriter::Publish(const std::vector<prometheus::MetricFamily>&) { return false; }
+void ShmWriter::Close() {}
+bool ShmReader::Request(const std::string&) { return false; }
+bool ShmReader::Read(const std::string&, std::vector<prometheus::MetricFamily>&, FamilyPool*,
+                     std::chrono::steady_clock::time_point) {
+  return false;
+}
+
+#endif
+
+} // namespace promkit::mux
@@ -0,0 +1,99 @@
+// Shared-memory transport between mux workers and the aggregator
+#pragma once
+
+#include "FamilyPool.hpp"
+
+#include <prometheus/metric_family.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace promkit::mux {
+
+// A worker's metric families published into a file-backed mmap segment under
+// the mux directory, split into a schema (names, help, types, labels, bucket
+// bounds, quantiles) and a flat vector of 8-byte values in schema order. The
+// worker publishes only when a reader asks for it (a request counter in the
+// segment header, a futex on Linux), rewriting the values under a seqlock and
+// the schema only when it changes, bumping its generation; an unscraped worker
+// never collects. POSIX only: Open fails elsewhere and the caller falls back to
+// the HTTP transport.
+class ShmWriter {
+ public:
+  ShmWriter() = default;
+  ~ShmWriter();
+  ShmWriter(const ShmWriter&) = delete;
+  ShmWriter& operator=(const ShmWriter&) = delete;
+
+  // Creates (or truncates) the segment file and writes the header.
+  bool Open(const std::string& path, const std::string& component, int pid);
+  // Waits up to timeout for a reader's request that no image answers yet; true
+  // when there is one, and the next Publish answers it.
+  bool WaitForRequest(std::chrono::milliseconds timeout);
+  // Wakes a thread blocked in WaitForRequest (which then returns false).
+  void Interrupt();
+  // Publishes fams as the segment's current image.
+  bool Publish(const std::vector<prometheus::MetricFamily>& fams);
+  // Unmaps and removes the segment file.
+  void Close();
+
+  const std::string& path() const { return path_; }
+
+ private:
+  bool Reserve(std::size_t payload);
+
+  std::string path_;
+  int fd_ = -1;
+  unsigned char* base_ = nullptr;
+  std::size_t mapped_ = 0;
+  std::string schema_;      // last published schema
+  std::string next_schema_; // encode scratch, reused across publishes
+  std::string values_;
+  std::uint32_t served_ = 0; // request the current image answers
+  std::uint32_t answer_ = 0; // request the next Publish answers
+};
+
+// Reads one worker's segment, keeping its decoded schema between calls so an
+// unchanged schema costs only a copy of the values vector. The segment is
+// opened for writing to post requests, so the reader runs as the worker's user.
+class ShmReader {
+ public:
+  // Asks the worker at path for a fresh image; the next Read waits for it.
+  // False when the segment cannot be opened for writing or is malformed.
+  bool Request(const std::string& path);
+  // Copies a consistent image of the segment at path into out, built from
+  // pool's spares when given, after waiting until deadline for the image that
+  // answers the last Request (the latest one otherwise). Returns false when
+  // the segment is missing, malformed, or kept busy by its writer.
+  bool Read(const std::string& path, std::vector<prometheus::MetricFamily>& out, FamilyPool* pool = nullptr,
+            std::chrono::steady_clock::time_point deadline = {});
+  // Bytes the last Read copied out of the segment.
+  std::size_t last_bytes() const noexcept { return image_.size(); }
+  // Time the last Read spent waiting for the worker to publish.
+  double last_wait_seconds() const noexcept { return wait_seconds_; }
+  // Whether the last Read gave up waiting and returned an older image.
+  bool timed_out() const noexcept { return timed_out_; }
+
+ private:
+  std::uint64_t generation_ = 0; // 0: nothing cached
+  std::vector<prometheus::MetricFamily> schema_;
+  std::string image_;
+  std::uint32_t request_ = 0; // request number posted by the last Request
+  bool requested_ = false;    // a Request not yet waited for
+  bool timed_out_ = false;
+  double wait_seconds_ = 0;
+};
+
+// Schema/values codec (native byte order; both ends run on the same host).
+void EncodeSchema(const std::vector<prometheus::MetricFamily>& fams, std::string& out);
+void EncodeValues(const std::vector<prometheus::MetricFamily>& fams, std::string& out);
+// Families with labels, bounds and quantiles set and all values zero.
+bool DecodeSchema(std::string_view in, std::vector<prometheus::MetricFamily>& out);
+// Fills values into families decoded from the matching schema.
+bool ApplyValues(std::string_view in, std::vector<prometheus::MetricFamily>& fams);
+
+} // namespace promkit::mux
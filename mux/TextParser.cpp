@@ -5,162 +5,291 @@
 
 #include <algorithm>
 #include <charconv>
-#include <cctype>
-#include <sstream>
+#include <cstring>
+#include <limits>
+#include <memory_resource>
 #include <string>
 #include <string_view>
-#include <vector>
-#include <limits>
 #include <unordered_map>
+#include <vector>
 
 namespace promkit::mux {
 
 namespace {
 
-static inline std::string trim(std::string_view sv) {
-  auto l = sv.find_first_not_of(" \t\r\n");
-  if (l == std::string_view::npos) return {};
-  auto r = sv.find_last_not_of(" \t\r\n");
-  return std::string(sv.substr(l, r - l + 1));
+using prometheus::MetricType;
+using Label = std::pair<std::string_view, std::string_view>;
+
+inline bool IsNameStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':'; }
+inline bool IsNameChar(char c) { return IsNameStart(c) || (c >= '0' && c <= '9'); }
+
+inline void SkipBlanks(std::string_view& sv) {
+  std::size_t i = 0;
+  while (i < sv.size() && (sv[i] == ' ' || sv[i] == '\t')) ++i;
+  sv.remove_prefix(i);
 }
 
-static bool parseLabels(std::string_view sv, std::vector<prometheus::ClientMetric::Label>& out) {
-  // format: {k="v",k2="v2"}
-  out.clear();
-  if (sv.size() < 2 || sv.front() != '{' || sv.back() != '}') return false;
-  sv.remove_prefix(1);
-  sv.remove_suffix(1);
-  while (!sv.empty()) {
-    auto comma = sv.find(',');
-    auto token = sv.substr(0, comma);
-    if (comma != std::string_view::npos) sv.remove_prefix(comma + 1); else sv = {};
-    auto eq = token.find('=');
-    if (eq == std::string_view::npos) break;
-    auto k = trim(token.substr(0, eq));
-    auto v = token.substr(eq + 1);
-    if (v.size() >= 2 && v.front() == '"' && v.back() == '"') v = v.substr(1, v.size()-2);
-    out.push_back({std::string(k), std::string(v)});
+inline std::string_view TakeName(std::string_view& sv) {
+  std::size_t i = 0;
+  if (!sv.empty() && IsNameStart(sv[0])) {
+    while (i < sv.size() && IsNameChar(sv[i])) ++i;
   }
-  return true;
+  auto name = sv.substr(0, i);
+  sv.remove_prefix(i);
+  return name;
 }
 
-static bool parseNumber(std::string_view sv, double& out) {
-  // Allow NaN/Inf; for simplicity, use stod fallback.
-  try {
-    std::string s(sv);
-    out = std::stod(s);
-    return true;
-  } catch (...) {
-    return false;
-  }
+// Number as written by the text format: decimal/exponent, [+-]Inf, NaN.
+bool ParseNumber(std::string_view sv, double& out) {
+  if (!sv.empty() && sv.front() == '+') sv.remove_prefix(1); // from_chars takes no leading '+'
+  if (sv.empty()) return false;
+  const auto res = std::from_chars(sv.data(), sv.data() + sv.size(), out);
+  return res.ec == std::errc{} && res.ptr == sv.data() + sv.size();
 }
 
-} // namespace
+// Per-parse state. Metric names are views into the input; series keys,
+// unescaped label values and the index nodes live in the arena, freed in one
+// go with the parser. Families and series come from pool when there is one.
+class Parser {
+ public:
+  Parser(std::string_view text, FamilyPool* pool) : text_(text), pool_(pool) {}
 
-std::vector<prometheus::MetricFamily> ParseTextExposition(const std::string& text) {
-  std::vector<prometheus::MetricFamily> fams;
-  std::istringstream iss(text);
-  std::string line;
-  // Map by base name without suffix (_bucket/_sum/_count for histogram)
-  std::unordered_map<std::string, prometheus::MetricType> ty_map;
-  std::unordered_map<std::string, std::string> help_map;
-  auto getFam = [&](const std::string& name, prometheus::MetricType ty, const std::string& help) -> prometheus::MetricFamily& {
-    for (auto& f : fams) if (f.name == name) return f;
-    fams.push_back({});
-    auto& f = fams.back();
-    f.name = name; f.help = help; f.type = ty;
-    return f;
-  };
-
-  while (std::getline(iss, line)) {
-    if (line.empty() || line[0] == '#') continue;
-    // name[labels] value [timestamp]
-    std::string name;
-    std::vector<prometheus::ClientMetric::Label> labels;
-    double value = 0;
+  std::vector<prometheus::MetricFamily> Run() {
+    std::string_view rest = text_;
+    while (!rest.empty()) {
+      const auto nl = rest.find('\n');
+      auto line = rest.substr(0, nl);
+      rest.remove_prefix(nl == std::string_view::npos ? rest.size() : nl + 1);
+      if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+      if (line.empty()) continue;
+      if (line.front() == '#') Comment(line);
+      else Sample(line);
+    }
+    for (auto& f : fams_) {
+      if (f.type != MetricType::Histogram) continue;
+      for (auto& m : f.metric) {
+        auto& b = m.histogram.bucket;
+        auto byBound = [](const auto& x, const auto& y) { return x.upper_bound < y.upper_bound; };
+        if (!std::is_sorted(b.begin(), b.end(), byBound)) std::sort(b.begin(), b.end(), byBound);
+      }
+    }
+    return std::move(fams_);
+  }
+
+ private:
+  std::string_view Keep(std::string_view s) {
+    if (s.empty()) return {};
+    auto* p = static_cast<char*>(arena_.allocate(s.size(), 1));
+    std::memcpy(p, s.data(), s.size());
+    return {p, s.size()};
+  }
+
+  std::size_t Family(std::string_view name, MetricType ty) {
+    auto [it, inserted] = fam_index_.try_emplace(name, fams_.size());
+    if (inserted) {
+      auto& f = pool_ ? fams_.emplace_back(pool_->Family()) : fams_.emplace_back();
+      f.name.assign(name);
+      f.type = ty;
+    }
+    return it->second;
+  }
 
-    std::string_view sv(line);
-    // name
-    size_t i = 0;
-    while (i < sv.size() && (std::isalnum((unsigned char)sv[i]) || sv[i]=='_' || sv[i]==':')) ++i;
-    name = std::string(sv.substr(0, i));
-    sv.remove_prefix(i);
-    // labels
-    if (!sv.empty() && sv.front() == '{') {
-      auto end = sv.find('}');
-      if (end == std::string_view::npos) continue;
-      auto lab = sv.substr(0, end + 1);
-      std::vector<prometheus::ClientMetric::Label> tmp;
-      if (!parseLabels(lab, tmp)) continue;
-      labels = std::move(tmp);
-      sv.remove_prefix(end + 1);
+  // # HELP name text / # TYPE name type; other comments are ignored.
+  void Comment(std::string_view line) {
+    line.remove_prefix(1);
+    SkipBlanks(line);
+    const bool help = line.starts_with("HELP");
+    if (!help && !line.starts_with("TYPE")) return;
+    line.remove_prefix(4);
+    SkipBlanks(line);
+    const auto name = TakeName(line);
+    if (name.empty()) return;
+    SkipBlanks(line);
+    if (help) {
+      auto& f = fams_[Family(name, MetricType::Untyped)];
+      f.help.clear();
+      for (std::size_t i = 0; i < line.size(); ++i) {
+        if (line[i] == '\\' && i + 1 < line.size()) {
+          ++i;
+          f.help.push_back(line[i] == 'n' ? '\n' : line[i]);
+        } else {
+          f.help.push_back(line[i]);
+        }
+      }
+      return;
     }
-    // space then value
-    auto p = sv.find_first_not_of(" \t");
-    if (p == std::string_view::npos) continue;
-    sv.remove_prefix(p);
-    // value up to space
-    auto q = sv.find_first_of(" \t");
-    auto vs = sv.substr(0, q);
-    if (!parseNumber(vs, value)) continue;
-
-    // histogram special cases
-    if (name.size() > 7 && name.ends_with("_bucket")) {
-      auto base = name.substr(0, name.size()-7);
-      // find le label; move it to bucket
-      prometheus::ClientMetric m;
-      m.label = labels;
-      double le = 0;
-      for (auto it = m.label.begin(); it != m.label.end(); ++it) {
-        if (it->name == "le") {
-          try { le = std::stod(it->value); } catch (...) { le = std::numeric_limits<double>::infinity(); }
-          m.label.erase(it);
-          break;
+    MetricType ty = MetricType::Untyped;
+    if (line.starts_with("counter")) ty = MetricType::Counter;
+    else if (line.starts_with("gauge")) ty = MetricType::Gauge;
+    else if (line.starts_with("histogram")) ty = MetricType::Histogram;
+    else if (line.starts_with("summary")) ty = MetricType::Summary;
+    auto& f = fams_[Family(name, ty)];
+    if (f.metric.empty()) f.type = ty; // HELP may have created it first
+  }
+
+  // {k="v",...}: values may contain escaped quotes/backslashes/newlines and
+  // commas; only escaped values are copied (into the arena).
+  bool Labels(std::string_view& sv) {
+    labels_.clear();
+    if (sv.empty() || sv.front() != '{') return true;
+    sv.remove_prefix(1);
+    while (true) {
+      SkipBlanks(sv);
+      if (sv.empty()) return false;
+      if (sv.front() == '}') { sv.remove_prefix(1); return true; }
+      const auto name = TakeName(sv);
+      SkipBlanks(sv);
+      if (name.empty() || sv.empty() || sv.front() != '=') return false;
+      sv.remove_prefix(1);
+      SkipBlanks(sv);
+      if (sv.empty() || sv.front() != '"') return false;
+      sv.remove_prefix(1);
+      std::size_t i = 0;
+      bool escaped = false;
+      while (i < sv.size() && sv[i] != '"') {
+        if (sv[i] == '\\') { escaped = true; ++i; }
+        ++i;
+      }
+      if (i >= sv.size()) return false;
+      auto value = sv.substr(0, i);
+      sv.remove_prefix(i + 1);
+      if (escaped) {
+        scratch_.clear();
+        for (std::size_t k = 0; k < value.size(); ++k) {
+          if (value[k] == '\\' && k + 1 < value.size()) {
+            ++k;
+            scratch_.push_back(value[k] == 'n' ? '\n' : value[k]);
+          } else {
+            scratch_.push_back(value[k]);
+          }
         }
+        value = Keep(scratch_);
       }
-      auto& f = getFam(base, prometheus::MetricType::Histogram, "");
-      // find or create metric with same labels
-      auto sameLabels = [&](const prometheus::ClientMetric& x){ return x.label == m.label; };
-      auto it = std::find_if(f.metric.begin(), f.metric.end(), sameLabels);
-      if (it == f.metric.end()) { f.metric.push_back({}); it = f.metric.end()-1; it->label = m.label; }
-      prometheus::ClientMetric::Bucket b; b.upper_bound = le; b.cumulative_count = static_cast<std::uint64_t>(value);
-      it->histogram.bucket.push_back(b);
-      continue;
+      labels_.emplace_back(name, value);
+      SkipBlanks(sv);
+      if (!sv.empty() && sv.front() == ',') sv.remove_prefix(1);
+    }
+  }
+
+  // Series of family fi with the current labels minus `skip` (le/quantile).
+  prometheus::ClientMetric& Series(std::size_t fi, std::string_view skip) {
+    key_.assign(reinterpret_cast<const char*>(&fi), sizeof(fi));
+    for (const auto& [k, v] : labels_) {
+      if (k == skip) continue;
+      key_.append(k);
+      key_.push_back('\0');
+      key_.append(v);
+      key_.push_back('\0');
     }
-    if (name.size() > 4 && name.ends_with("_sum")) {
-      auto base = name.substr(0, name.size()-4);
-      auto& f = getFam(base, prometheus::MetricType::Histogram, "");
-      prometheus::ClientMetric m; m.label = labels; m.histogram.sample_sum = value;
-      // merge into existing metric
-      auto it = std::find_if(f.metric.begin(), f.metric.end(), [&](const auto& x){ return x.label == m.label; });
-      if (it == f.metric.end()) f.metric.push_back(m); else it->histogram.sample_sum = m.histogram.sample_sum;
-      continue;
+    auto& f = fams_[fi];
+    if (auto it = series_index_.find(std::string_view(key_)); it != series_index_.end()) return f.metric[it->second];
+    series_index_.emplace(Keep(key_), f.metric.size());
+    auto& m = NewMetric(f);
+    m.label.reserve(labels_.size());
+    for (const auto& [k, v] : labels_) {
+      if (k != skip) m.label.push_back({std::string(k), std::string(v)});
     }
-    if (name.size() > 6 && name.ends_with("_count")) {
-      auto base = name.substr(0, name.size()-6);
-      auto& f = getFam(base, prometheus::MetricType::Histogram, "");
-      prometheus::ClientMetric m; m.label = labels; m.histogram.sample_count = static_cast<std::uint64_t>(value);
-      auto it = std::find_if(f.metric.begin(), f.metric.end(), [&](const auto& x){ return x.label == m.label; });
-      if (it == f.metric.end()) f.metric.push_back(m); else it->histogram.sample_count = m.histogram.sample_count;
-      continue;
+    return m;
+  }
+
+  prometheus::ClientMetric& NewMetric(prometheus::MetricFamily& f) {
+    return pool_ ? f.metric.emplace_back(pool_->Metric()) : f.metric.emplace_back();
+  }
+
+  std::string_view LabelValue(std::string_view name) const {
+    for (const auto& [k, v] : labels_) {
+      if (k == name) return v;
     }
+    return {};
+  }
 
-    // consult TYPE map if known
-    auto tyit = ty_map.find(name);
-    auto ty = (tyit == ty_map.end()) ? prometheus::MetricType::Untyped : tyit->second;
-    auto hlpit = help_map.find(name);
-    auto& f = getFam(name, ty, (hlpit==help_map.end()?std::string():hlpit->second));
-    prometheus::ClientMetric m; m.label = labels; m.untyped.value = value;
-    f.metric.push_back(std::move(m));
+  // name[{labels}] value [timestamp]
+  void Sample(std::string_view line) {
+    auto sv = line;
+    const auto name = TakeName(sv);
+    if (name.empty()) return;
+    if (!Labels(sv)) return;
+    SkipBlanks(sv);
+    auto value_text = sv.substr(0, sv.find_first_of(" \t"));
+    double value = 0;
+    if (!ParseNumber(value_text, value)) return;
+
+    // Exact family first (counters, gauges, untyped, and names declared by TYPE)
+    if (auto it = fam_index_.find(name); it != fam_index_.end()) {
+      auto& f = fams_[it->second];
+      if (f.type != MetricType::Histogram && f.type != MetricType::Summary) {
+        Plain(it->second, value);
+        return;
+      }
+      if (f.type == MetricType::Summary) {
+        auto& m = Series(it->second, "quantile");
+        double q = 0;
+        if (ParseNumber(LabelValue("quantile"), q)) m.summary.quantile.push_back({q, value});
+        return;
+      }
+    }
+    // Suffixed sample of a histogram/summary; without a TYPE line, _bucket/_sum/_count
+    // imply a histogram as before.
+    for (std::string_view suffix : {"_bucket", "_sum", "_count"}) {
+      if (name.size() <= suffix.size() || !name.ends_with(suffix)) continue;
+      const auto base = name.substr(0, name.size() - suffix.size());
+      auto it = fam_index_.find(base);
+      std::size_t fi = 0;
+      if (it != fam_index_.end()) {
+        fi = it->second;
+        if (fams_[fi].type != MetricType::Histogram && fams_[fi].type != MetricType::Summary) break;
+      } else {
+        fi = Family(base, MetricType::Histogram);
+      }
+      const bool hist = fams_[fi].type == MetricType::Histogram;
+      if (suffix == "_bucket") {
+        if (!hist) break;
+        double le = std::numeric_limits<double>::infinity();
+        (void)ParseNumber(LabelValue("le"), le);
+        Series(fi, "le").histogram.bucket.push_back({static_cast<std::uint64_t>(value), le});
+      } else if (suffix == "_sum") {
+        auto& m = Series(fi, hist ? "le" : "quantile");
+        (hist ? m.histogram.sample_sum : m.summary.sample_sum) = value;
+      } else {
+        auto& m = Series(fi, hist ? "le" : "quantile");
+        (hist ? m.histogram.sample_count : m.summary.sample_count) = static_cast<std::uint64_t>(value);
+      }
+      return;
+    }
+    Plain(Family(name, MetricType::Untyped), value);
   }
 
-  // Sort histogram buckets by le
-  for (auto& f : fams) if (f.type == prometheus::MetricType::Histogram) {
-    for (auto& m : f.metric) {
-      std::sort(m.histogram.bucket.begin(), m.histogram.bucket.end(), [](auto& a, auto& b){ return a.upper_bound < b.upper_bound; });
+  void Plain(std::size_t fi, double value) {
+    auto& f = fams_[fi];
+    auto& m = NewMetric(f);
+    m.label.reserve(labels_.size());
+    for (const auto& [k, v] : labels_) m.label.push_back({std::string(k), std::string(v)});
+    switch (f.type) {
+      case MetricType::Counter: m.counter.value = value; break;
+      case MetricType::Gauge: m.gauge.value = value; break;
+      default: m.untyped.value = value; break;
     }
   }
-  return fams;
+
+  std::string_view text_;
+  FamilyPool* pool_;
+  std::pmr::monotonic_buffer_resource arena_{16 * 1024};
+  std::vector<prometheus::MetricFamily> fams_;
+  std::pmr::unordered_map<std::string_view, std::size_t> fam_index_{&arena_};    // name -> index in fams_
+  std::pmr::unordered_map<std::string_view, std::size_t> series_index_{&arena_}; // family + labels -> index in metric
+  std::vector<Label> labels_; // labels of the current line
+  std::string key_;           // scratch series key
+  std::string scratch_;       // scratch unescaped value
+};
+
+} // namespace
+
+std::vector<prometheus::MetricFamily> ParseTextExposition(std::string_view text, FamilyPool* pool) {
+  try {
+    return Parser(text, pool).Run();
+  } catch (...) {
+    return {};
+  }
 }
 
 } // namespace promkit::mux
@@ -1,14 +1,17 @@
 // Minimal text exposition parser: parses Prometheus text format into MetricFamily
 #pragma once
+#include "FamilyPool.hpp"
+
 #include <prometheus/metric_family.h>
-#include <string>
+#include <string_view>
 #include <vector>
 
 namespace promkit::mux {
 
-// Parse Prometheus text exposition to families. Best-effort; ignores HELP/TYPE.
-// Returns empty on parse error. Only supports counter, gauge, histogram lines.
-std::vector<prometheus::MetricFamily> ParseTextExposition(const std::string& text);
+// Parse Prometheus text exposition to families in one pass over text. Types and
+// help come from # TYPE / # HELP lines (counter, gauge, histogram, summary,
+// untyped); without a TYPE line, _bucket/_sum/_count samples form a histogram.
+// Malformed lines are skipped. Families and series are taken from pool when given.
+std::vector<prometheus::MetricFamily> ParseTextExposition(std::string_view text, FamilyPool* pool = nullptr);
 
 } // namespace promkit::mux
-
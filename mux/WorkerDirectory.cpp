@@ -0,0 +1,239 @@
+#include "WorkerDirectory.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <poll.h>
+#  include <signal.h>
+#  include <unistd.h>
+#endif
+#ifdef __linux__
+#  include <sys/inotify.h>
+#  include <sys/syscall.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+#ifdef _WIN32
+static bool PidAlive(int pid) {
+  HANDLE h = ::OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+  if (!h) return false;
+  DWORD code = 0; BOOL ok = ::GetExitCodeProcess(h, &code);
+  ::CloseHandle(h);
+  return ok && code == STILL_ACTIVE;
+}
+#else
+static bool PidAlive(int pid) { return ::kill(pid, 0) == 0; }
+#endif
+
+// A descriptor that becomes readable when pid exits, or -1.
+static int OpenPidfd(int pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  return static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+static void ClosePidfd(int fd) {
+#ifndef _WIN32
+  if (fd >= 0) ::close(fd);
+#else
+  (void)fd;
+#endif
+}
+
+// File format: endpoint host:port (or shm <segment path>)\ncomponent <name>\npid <pid>\npath /metrics
+static bool ReadDescriptor(const fs::path& file, promkit::mux::WorkerEndpoint& we) {
+  std::ifstream ifs(file);
+  if (!ifs) return false;
+  we.host = "127.0.0.1"; we.port = 0; we.path = "/metrics";
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.starts_with("endpoint ")) {
+      auto e = line.substr(9);
+      auto colon = e.find(':');
+      if (colon != std::string::npos) { we.host = e.substr(0, colon); we.port = std::stoi(e.substr(colon+1)); }
+    } else if (line.starts_with("component ")) {
+      we.component = line.substr(10);
+    } else if (line.starts_with("pid ")) {
+      we.pid = std::stoi(line.substr(4));
+    } else if (line.starts_with("path ")) {
+      we.path = line.substr(5);
+    } else if (line.starts_with("shm ")) {
+      we.shm = line.substr(4);
+    }
+  }
+  return (we.port > 0 || !we.shm.empty()) && !we.component.empty();
+}
+
+// Whether shm names the segment a worker of dir would create for its pid:
+// <dir>/shm/seg.<pid>. Descriptors are written by other processes, so nothing
+// else is ever deleted on their say-so.
+static bool IsOwnSegment(const std::string& dir, const promkit::mux::WorkerEndpoint& we) {
+  if (we.pid <= 0) return false;
+  const fs::path seg(we.shm);
+  if (seg.filename() != "seg." + std::to_string(we.pid)) return false;
+  std::error_code ec1, ec2;
+  const auto parent = fs::weakly_canonical(seg.parent_path(), ec1);
+  const auto expected = fs::weakly_canonical(fs::path(dir) / "shm", ec2);
+  return !ec1 && !ec2 && parent == expected;
+}
+} // anonymous
+
+namespace promkit::mux {
+
+WorkerDirectory::WorkerDirectory(std::string dir) : dir_(std::move(dir)) {}
+
+WorkerDirectory::~WorkerDirectory() {
+  for (auto& [name, e] : entries_) ClosePidfd(e.pidfd);
+#ifdef __linux__
+  if (inotify_fd_ >= 0) ::close(inotify_fd_);
+#endif
+}
+
+// Watch before the first rescan so no descriptor written in between is missed.
+bool WorkerDirectory::Watch() {
+#ifdef __linux__
+  if (inotify_fd_ >= 0) return true;
+  inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) return false;
+  if (::inotify_add_watch(inotify_fd_, dir_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0) {
+    ::close(inotify_fd_);
+    inotify_fd_ = -1;
+    return false;
+  }
+  rescan_ = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void WorkerDirectory::DrainEvents() {
+#ifdef __linux__
+  alignas(inotify_event) char buf[8192];
+  while (true) {
+    const auto n = ::read(inotify_fd_, buf, sizeof(buf));
+    if (n <= 0) break; // EAGAIN: queue empty
+    for (std::size_t off = 0; off < static_cast<std::size_t>(n);) {
+      const auto* ev = reinterpret_cast<const inotify_event*>(buf + off);
+      off += sizeof(inotify_event) + ev->len;
+      if (ev->mask & (IN_Q_OVERFLOW | IN_IGNORED)) {
+        rescan_ = true;
+        if (ev->mask & IN_IGNORED) { // directory removed: watch again once it is back
+          ::close(inotify_fd_);
+          inotify_fd_ = -1;
+          return;
+        }
+        continue;
+      }
+      if (ev->len == 0 || (ev->mask & IN_ISDIR)) continue;
+      const std::string name(ev->name);
+      if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) Load(name);
+      else Drop(name, false);
+    }
+  }
+#endif
+}
+
+void WorkerDirectory::Rescan() {
+  rescan_ = false;
+  std::vector<std::string> seen;
+  std::error_code ec;
+  for (auto& de : fs::directory_iterator(dir_, ec)) {
+    if (!de.is_regular_file(ec)) continue;
+    seen.push_back(de.path().filename().string());
+    Load(seen.back());
+  }
+  std::erase_if(entries_, [&](auto& kv) {
+    if (std::find(seen.begin(), seen.end(), kv.first) != seen.end()) return false;
+    ClosePidfd(kv.second.pidfd);
+    return true;
+  });
+}
+
+void WorkerDirectory::Load(const std::string& name) {
+  const auto file = fs::path(dir_) / name;
+  WorkerEndpoint we;
+  try {
+    if (!ReadDescriptor(file, we)) {
+      Drop(name, false);
+      return;
+    }
+  } catch (...) {
+    Drop(name, false);
+    return;
+  }
+  auto& e = entries_[name];
+  if (e.we.pid != we.pid) {
+    ClosePidfd(e.pidfd);
+    e.pidfd = we.pid > 0 ? OpenPidfd(we.pid) : -1;
+  }
+  e.we = std::move(we);
+  // Prune stale descriptor: pid not alive
+  if (e.we.pid > 0 && !PidAlive(e.we.pid)) Drop(name, true);
+}
+
+void WorkerDirectory::Drop(const std::string& name, bool remove_files) {
+  auto it = entries_.find(name);
+  if (remove_files) {
+    std::error_code ec;
+    fs::remove(fs::path(dir_) / name, ec);
+    if (it != entries_.end() && !it->second.we.shm.empty() && IsOwnSegment(dir_, it->second.we)) {
+      fs::remove(it->second.we.shm, ec);
+    }
+  }
+  if (it == entries_.end()) return;
+  ClosePidfd(it->second.pidfd);
+  entries_.erase(it);
+}
+
+void WorkerDirectory::Reap() {
+  std::vector<std::string> dead;
+#ifndef _WIN32
+  std::vector<pollfd> pfds;
+  std::vector<const std::string*> names;
+  for (const auto& [name, e] : entries_) {
+    if (e.pidfd < 0) continue;
+    pfds.push_back({e.pidfd, POLLIN, 0});
+    names.push_back(&name);
+  }
+  if (!pfds.empty() && ::poll(pfds.data(), static_cast<nfds_t>(pfds.size()), 0) > 0) {
+    for (std::size_t i = 0; i < pfds.size(); ++i) {
+      if (pfds[i].revents & POLLIN) dead.push_back(*names[i]);
+    }
+  }
+#endif
+  const auto now = std::chrono::steady_clock::now();
+  if (now >= next_sweep_) {
+    next_sweep_ = now + kSweepInterval;
+    for (const auto& [name, e] : entries_) {
+      if (e.pidfd < 0 && e.we.pid > 0 && !PidAlive(e.we.pid)) dead.push_back(name);
+    }
+  }
+  for (const auto& name : dead) Drop(name, true);
+}
+
+std::vector<WorkerEndpoint> WorkerDirectory::Workers() {
+  std::vector<WorkerEndpoint> out;
+  if (dir_.empty()) return out;
+  if (Watch()) DrainEvents();
+  if (rescan_ || inotify_fd_ < 0) Rescan();
+  Reap();
+  out.reserve(entries_.size());
+  for (const auto& [name, e] : entries_) out.push_back(e.we);
+  // Stable merge order (gauge_agg = "last" takes the last component)
+  std::sort(out.begin(), out.end(), [](const WorkerEndpoint& a, const WorkerEndpoint& b) { return a.component < b.component; });
+  return out;
+}
+
+} // namespace promkit::mux
@@ -0,0 +1,55 @@
+// In-memory table of the worker descriptors in a mux directory
+#pragma once
+
+#include "MuxCollector.hpp"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace promkit::mux {
+
+// Keeps the descriptors of dir parsed between scrapes. On Linux the directory
+// is watched with inotify and each worker is tracked through a pidfd, so a
+// scrape with nothing changed costs one read of the inotify queue and one poll
+// over the pidfds; descriptors are only re-read when they are written, and the
+// whole directory only at start and after a queue overflow. Where pidfds are
+// unavailable, liveness is swept with kill(pid, 0) every kSweepInterval.
+// Elsewhere the directory is rescanned on every call, as before.
+// Descriptors of exited workers are removed together with their shm segment,
+// when the descriptor names one where the worker would create it
+// (<dir>/shm/seg.<pid>).
+class WorkerDirectory {
+ public:
+  explicit WorkerDirectory(std::string dir);
+  ~WorkerDirectory();
+  WorkerDirectory(const WorkerDirectory&) = delete;
+  WorkerDirectory& operator=(const WorkerDirectory&) = delete;
+
+  // Live workers, sorted by component. Not thread-safe.
+  std::vector<WorkerEndpoint> Workers();
+
+  static constexpr std::chrono::seconds kSweepInterval{5};
+
+ private:
+  struct Entry {
+    WorkerEndpoint we;
+    int pidfd = -1;
+  };
+
+  bool Watch();
+  void DrainEvents();
+  void Rescan();
+  void Load(const std::string& name);
+  void Drop(const std::string& name, bool remove_files);
+  void Reap();
+
+  std::string dir_;
+  int inotify_fd_ = -1;
+  bool rescan_ = true;
+  std::chrono::steady_clock::time_point next_sweep_{};
+  std::map<std::string, Entry> entries_; // descriptor file name -> worker
+};
+
+} // namespace promkit::mux
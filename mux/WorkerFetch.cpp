@@ -0,0 +1,176 @@
+#include "WorkerFetch.hpp"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#  include <windows.h>
+#else
+#  include <arpa/inet.h>
+#  include <cerrno>
+#  include <fcntl.h>
+#  include <netinet/in.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <unistd.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+struct WsaInit { WsaInit(){ WSADATA d; WSAStartup(MAKEWORD(2,2), &d);} ~WsaInit(){ WSACleanup(); } };
+static WsaInit g_wsa_init; // ensure WSA is initialized once
+using socket_t = SOCKET;
+constexpr socket_t invalid_socket = INVALID_SOCKET;
+constexpr int kSendFlags = 0;
+inline void closesock(socket_t s){ if(s!=INVALID_SOCKET) ::closesocket(s); }
+inline bool SetNonBlocking(socket_t s) { u_long on = 1; return ::ioctlsocket(s, FIONBIO, &on) == 0; }
+inline bool WouldBlock() { const int e = ::WSAGetLastError(); return e == WSAEWOULDBLOCK || e == WSAEINPROGRESS; }
+inline bool Interrupted() { return ::WSAGetLastError() == WSAEINTR; }
+inline int PollFds(pollfd* fds, std::size_t n, int ms) { return ::WSAPoll(fds, static_cast<ULONG>(n), ms); }
+#else
+using socket_t = int;
+constexpr socket_t invalid_socket = -1;
+#  ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL; // a worker that went away must not SIGPIPE the aggregator
+#  else
+constexpr int kSendFlags = 0;
+#  endif
+inline void closesock(socket_t s){ if(s>=0) ::close(s); }
+inline bool SetNonBlocking(socket_t s) { const int fl = ::fcntl(s, F_GETFL, 0); return fl >= 0 && ::fcntl(s, F_SETFL, fl | O_NONBLOCK) == 0; }
+inline bool WouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS; }
+inline bool Interrupted() { return errno == EINTR; }
+inline int PollFds(pollfd* fds, std::size_t n, int ms) { return ::poll(fds, static_cast<nfds_t>(n), ms); }
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+enum class Stage { Connecting, Sending, Reading, Done };
+
+struct Conn {
+  socket_t sock = invalid_socket;
+  Stage stage = Stage::Done;
+  std::string req;
+  std::size_t sent = 0;
+  std::string resp;
+  Clock::time_point deadline;
+};
+
+// "HTTP/1.x 200 ..." + headers + body -> body; false unless status is 200.
+bool ExtractBody(std::string& resp) {
+  std::string_view sv(resp);
+  if (!sv.starts_with("HTTP/")) return false;
+  const auto sp = sv.find(' ');
+  if (sp == std::string_view::npos || sv.substr(sp + 1, 3) != "200") return false;
+  const auto pos = sv.find("\r\n\r\n");
+  if (pos == std::string_view::npos) return false;
+  resp.erase(0, pos + 4);
+  return true;
+}
+
+} // namespace
+
+namespace promkit::mux {
+
+std::vector<FetchResult> FetchWorkers(const std::vector<WorkerEndpoint>& ws, std::chrono::milliseconds per_worker,
+                                      std::chrono::milliseconds budget) {
+  const auto start = Clock::now();
+  const auto hard_end = start + budget;
+  std::vector<FetchResult> out(ws.size());
+  std::vector<Conn> conns(ws.size());
+  std::size_t active = 0;
+
+  auto finish = [&](std::size_t i, bool ok, bool timed_out) {
+    auto& c = conns[i];
+    closesock(c.sock);
+    c.sock = invalid_socket;
+    c.stage = Stage::Done;
+    auto& r = out[i];
+    r.ok = ok && ExtractBody(c.resp);
+    if (r.ok) r.body = std::move(c.resp);
+    r.timed_out = timed_out;
+    r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    --active;
+  };
+
+  for (std::size_t i = 0; i < ws.size(); ++i) {
+    const auto& we = ws[i];
+    if (!we.shm.empty() || we.port <= 0) continue;
+    auto& c = conns[i];
+    c.sock = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (c.sock == invalid_socket) continue;
+    c.stage = Stage::Connecting;
+    c.deadline = std::min(start + per_worker, hard_end);
+    c.req = "GET " + we.path + " HTTP/1.0\r\nHost: " + we.host + "\r\nConnection: close\r\n\r\n";
+    ++active;
+    sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_port = htons(static_cast<std::uint16_t>(we.port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // 127.0.0.1
+    if (!SetNonBlocking(c.sock)) { finish(i, false, false); continue; }
+    if (::connect(c.sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) c.stage = Stage::Sending;
+    else if (!WouldBlock()) finish(i, false, false);
+  }
+
+  std::vector<pollfd> pfds;
+  std::vector<std::size_t> idx;
+  char buf[16384];
+  while (active > 0) {
+    const auto now = Clock::now();
+    auto next = hard_end;
+    pfds.clear();
+    idx.clear();
+    for (std::size_t i = 0; i < conns.size(); ++i) {
+      auto& c = conns[i];
+      if (c.stage == Stage::Done) continue;
+      if (c.deadline <= now) { finish(i, false, true); continue; }
+      next = std::min(next, c.deadline);
+      pollfd p{};
+      p.fd = c.sock;
+      p.events = c.stage == Stage::Reading ? POLLIN : POLLOUT;
+      pfds.push_back(p);
+      idx.push_back(i);
+    }
+    if (pfds.empty()) break;
+    const auto wait = std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+    const int rc = PollFds(pfds.data(), pfds.size(), static_cast<int>(std::max<long long>(wait, 0)));
+    if (rc < 0) {
+      if (Interrupted()) continue;
+      for (auto i : idx) finish(i, false, false);
+      break;
+    }
+    for (std::size_t k = 0; k < pfds.size(); ++k) {
+      if (pfds[k].revents == 0) continue;
+      const auto i = idx[k];
+      auto& c = conns[i];
+      if (c.stage == Stage::Connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (::getsockopt(c.sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &len) != 0 || err != 0) {
+          finish(i, false, false);
+          continue;
+        }
+        c.stage = Stage::Sending;
+      }
+      if (c.stage == Stage::Sending) {
+        const auto n = ::send(c.sock, c.req.data() + c.sent, static_cast<int>(c.req.size() - c.sent), kSendFlags);
+        if (n > 0) c.sent += static_cast<std::size_t>(n);
+        else if (!WouldBlock()) { finish(i, false, false); continue; }
+        if (c.sent == c.req.size()) c.stage = Stage::Reading;
+        continue;
+      }
+      // Reading: drain what is available; EOF completes the response (HTTP/1.0, Connection: close)
+      while (true) {
+        const auto n = ::recv(c.sock, buf, static_cast<int>(sizeof(buf)), 0);
+        if (n > 0) { c.resp.append(buf, static_cast<std::size_t>(n)); continue; }
+        if (n == 0) finish(i, true, false);
+        else if (!WouldBlock()) finish(i, false, false);
+        break;
+      }
+    }
+  }
+  return out;
+}
+
+} // namespace promkit::mux
@@ -0,0 +1,25 @@
+// Concurrent, deadline-bounded HTTP fetch of worker expositions
+#pragma once
+
+#include "MuxCollector.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace promkit::mux {
+
+struct FetchResult {
+  std::string body;       // exposition text, headers stripped (ok only)
+  bool ok = false;        // HTTP 200 received in full
+  bool timed_out = false; // hit its deadline (per worker or the overall budget)
+  double seconds = 0;     // time until done, failed or expired
+};
+
+// Fetches every HTTP worker of ws at once over non-blocking loopback sockets
+// multiplexed with poll. Each worker gets per_worker; the call returns within
+// budget. Results are parallel to ws; shm workers are left untouched (!ok).
+std::vector<FetchResult> FetchWorkers(const std::vector<WorkerEndpoint>& ws, std::chrono::milliseconds per_worker,
+                                      std::chrono::milliseconds budget);
+
+} // namespace promkit::mux
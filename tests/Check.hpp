@@ -0,0 +1,116 @@
+// Minimal checks and a golden dump of metric families for the promkit tests
+#pragma once
+
+#include <prometheus/metric_family.h>
+#include <prometheus/metric_type.h>
+
+#include <charconv>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace promkit::test {
+
+inline int& Failures() {
+  static int n = 0;
+  return n;
+}
+
+inline void Fail(const char* file, int line, const std::string& what) {
+  ++Failures();
+  std::fprintf(stderr, "%s:%d: FAILED: %s\n", file, line, what.c_str());
+}
+
+// Runs the named cases in order; the exit code of main.
+inline int Run(const std::vector<std::pair<const char*, std::function<void()>>>& cases) {
+  for (const auto& [name, fn] : cases) {
+    const int before = Failures();
+    fn();
+    std::fprintf(stderr, "%s %s\n", Failures() == before ? "ok  " : "FAIL", name);
+  }
+  return Failures() == 0 ? 0 : 1;
+}
+
+// Shortest round-trip form: "nan", "inf", "-inf", "0.5", "1e-09".
+inline std::string Num(double v) {
+  char buf[32];
+  return {buf, std::to_chars(buf, buf + sizeof(buf), v).ptr};
+}
+
+inline std::string Quote(std::string_view s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    if (c == '\n') out += "\\n";
+    else out += c;
+  }
+  return out + '"';
+}
+
+// One line per family ("type name "help""), one indented line per series:
+//   {k="v",...} value
+//   {k="v",...} count=N sum=S [bound:count ...]        histograms
+//   {k="v",...} count=N sum=S [quantile:value ...]     summaries
+inline std::string Dump(const std::vector<prometheus::MetricFamily>& fams) {
+  using prometheus::MetricType;
+  std::string out;
+  for (const auto& f : fams) {
+    switch (f.type) {
+      case MetricType::Counter: out += "counter "; break;
+      case MetricType::Gauge: out += "gauge "; break;
+      case MetricType::Histogram: out += "histogram "; break;
+      case MetricType::Summary: out += "summary "; break;
+      case MetricType::Info: out += "info "; break;
+      default: out += "untyped "; break;
+    }
+    out += f.name + " " + Quote(f.help) + "\n";
+    for (const auto& m : f.metric) {
+      out += "  {";
+      for (std::size_t i = 0; i < m.label.size(); ++i) {
+        out += (i ? "," : "") + m.label[i].name + "=" + Quote(m.label[i].value);
+      }
+      out += "} ";
+      switch (f.type) {
+        case MetricType::Counter: out += Num(m.counter.value); break;
+        case MetricType::Gauge: out += Num(m.gauge.value); break;
+        case MetricType::Info: out += Num(m.info.value); break;
+        case MetricType::Histogram:
+          out += "count=" + std::to_string(m.histogram.sample_count) + " sum=" + Num(m.histogram.sample_sum) + " [";
+          for (std::size_t i = 0; i < m.histogram.bucket.size(); ++i) {
+            const auto& b = m.histogram.bucket[i];
+            out += (i ? " " : "") + Num(b.upper_bound) + ":" + std::to_string(b.cumulative_count);
+          }
+          out += "]";
+          break;
+        case MetricType::Summary:
+          out += "count=" + std::to_string(m.summary.sample_count) + " sum=" + Num(m.summary.sample_sum) + " [";
+          for (std::size_t i = 0; i < m.summary.quantile.size(); ++i) {
+            const auto& q = m.summary.quantile[i];
+            out += (i ? " " : "") + Num(q.quantile) + ":" + Num(q.value);
+          }
+          out += "]";
+          break;
+        default: out += Num(m.untyped.value); break;
+      }
+      out += "\n";
+    }
+  }
+  return out;
+}
+
+} // namespace promkit::test
+
+#define PK_CHECK(cond) \
+  do { \
+    if (!(cond)) ::promkit::test::Fail(__FILE__, __LINE__, #cond); \
+  } while (0)
+
+// Compares strings (golden dumps), printing both on a mismatch.
+#define PK_CHECK_EQ(actual, expected) \
+  do { \
+    const std::string pk_a_ = (actual), pk_e_ = (expected); \
+    if (pk_a_ != pk_e_) ::promkit::test::Fail(__FILE__, __LINE__, "expected:\n" + pk_e_ + "actual:\n" + pk_a_); \
+  } while (0)
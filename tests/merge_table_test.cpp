@@ -0,0 +1,163 @@
+// MergeTable: per-component series, aggregation, bucket merging and sketches
+#include "Check.hpp"
+#include "MergeTable.hpp"
+#include "TextParser.hpp"
+
+#include <string>
+
+using promkit::mux::MergePolicies;
+using promkit::mux::MergePolicy;
+using promkit::mux::MergeTable;
+using promkit::mux::ParseTextExposition;
+using promkit::test::Dump;
+
+namespace {
+
+// Merges the text expositions of several workers.
+std::string Merge(std::initializer_list<std::string> workers, const MergePolicies* policies = nullptr) {
+  MergeTable table(policies);
+  for (const auto& w : workers) {
+    for (auto& f : ParseTextExposition(w)) table.Add(std::move(f));
+  }
+  return Dump(table.Take());
+}
+
+void CountersAreKeptAndSummed() {
+  PK_CHECK_EQ(Merge({"# TYPE c counter\nc{component=\"a\",op=\"x\"} 1\n",
+                     "# TYPE c counter\nc{component=\"b\",op=\"x\"} 2\nc{component=\"b\",op=\"y\"} 5\n"}),
+              "counter c \"\"\n"
+              "  {component=\"a\",op=\"x\"} 1\n"
+              "  {component=\"b\",op=\"x\"} 2\n"
+              "  {component=\"b\",op=\"y\"} 5\n"
+              "  {op=\"x\"} 3\n"
+              "  {op=\"y\"} 5\n");
+}
+
+void GaugesDefaultToPerProcess() {
+  PK_CHECK_EQ(Merge({"# TYPE g gauge\ng{component=\"a\"} 1\n", "# TYPE g gauge\ng{component=\"b\"} 2\n"}),
+              "gauge g \"\"\n"
+              "  {component=\"a\"} 1\n"
+              "  {component=\"b\"} 2\n");
+}
+
+void GaugePolicies() {
+  MergePolicies policies;
+  policies["g_max"] = promkit::mux::MakeMergePolicy("gauge", "sum_only", "max");
+  policies["g_last"] = promkit::mux::MakeMergePolicy("gauge", "sum_only", "last");
+  policies["g_sum"] = promkit::mux::MakeMergePolicy("gauge", "", "sum");
+  PK_CHECK_EQ(Merge({"# TYPE g_max gauge\ng_max{component=\"a\"} 3\n# TYPE g_last gauge\ng_last{component=\"a\"} 3\n"
+                     "# TYPE g_sum gauge\ng_sum{component=\"a\"} 3\n",
+                     "# TYPE g_max gauge\ng_max{component=\"b\"} 2\n# TYPE g_last gauge\ng_last{component=\"b\"} 2\n"
+                     "# TYPE g_sum gauge\ng_sum{component=\"b\"} 2\n"},
+                    &policies),
+              "gauge g_max \"\"\n"
+              "  {} 3\n"
+              "gauge g_last \"\"\n"
+              "  {} 2\n"
+              "gauge g_sum \"\"\n"
+              "  {component=\"a\"} 3\n"
+              "  {component=\"b\"} 2\n"
+              "  {} 5\n");
+}
+
+void HistogramsWithSameBounds() {
+  MergePolicies policies;
+  policies["h"] = promkit::mux::MakeMergePolicy("histogram", "sum_only", "");
+  PK_CHECK_EQ(Merge({"# TYPE h histogram\nh_bucket{component=\"a\",le=\"1\"} 1\nh_bucket{component=\"a\",le=\"+Inf\"} 2\n"
+                     "h_sum{component=\"a\"} 1.5\nh_count{component=\"a\"} 2\n",
+                     "# TYPE h histogram\nh_bucket{component=\"b\",le=\"1\"} 3\nh_bucket{component=\"b\",le=\"+Inf\"} 3\n"
+                     "h_sum{component=\"b\"} 0.5\nh_count{component=\"b\"} 3\n"},
+                    &policies),
+              "histogram h \"\"\n"
+              "  {} count=5 sum=2 [1:4 inf:5]\n");
+}
+
+void HistogramsWithDifferentBounds() {
+  MergePolicies policies;
+  policies["h"] = promkit::mux::MakeMergePolicy("histogram", "sum_only", "");
+  // At each bound of the union, each side adds its cumulative count at the
+  // nearest bound at or below it
+  PK_CHECK_EQ(Merge({"# TYPE h histogram\nh_bucket{component=\"a\",le=\"1\"} 1\nh_bucket{component=\"a\",le=\"2\"} 3\n"
+                     "h_bucket{component=\"a\",le=\"+Inf\"} 4\nh_count{component=\"a\"} 4\n",
+                     "# TYPE h histogram\nh_bucket{component=\"b\",le=\"1.5\"} 2\nh_bucket{component=\"b\",le=\"2\"} 2\n"
+                     "h_bucket{component=\"b\",le=\"+Inf\"} 5\nh_count{component=\"b\"} 5\n",
+                     "# TYPE h histogram\nh_bucket{component=\"c\",le=\"+Inf\"} 1\nh_count{component=\"c\"} 1\n"},
+                    &policies),
+              "histogram h \"\"\n"
+              "  {} count=10 sum=0 [1:1 1.5:3 2:5 inf:10]\n");
+}
+
+void SummariesAreNeverSummed() {
+  PK_CHECK_EQ(Merge({"# TYPE s summary\ns{component=\"a\",quantile=\"0.5\"} 1\ns_count{component=\"a\"} 1\n",
+                     "# TYPE s summary\ns{component=\"b\",quantile=\"0.5\"} 2\ns_count{component=\"b\"} 1\n"}),
+              "summary s \"\"\n"
+              "  {component=\"a\"} count=1 sum=0 [0.5:1]\n"
+              "  {component=\"b\"} count=1 sum=0 [0.5:2]\n");
+}
+
+void SketchMarkers() {
+  MergePolicy p;
+  PK_CHECK(promkit::mux::SketchMarker(3, {0.5, 0.99}) == "3:0.5,0.99");
+  PK_CHECK(promkit::mux::ParseSketchMarker("3:0.5,0.99", p) && p.sketch_schema == 3 && p.quantiles.size() == 2 &&
+           p.quantiles[0] == 0.5 && p.quantiles[1] == 0.99);
+  PK_CHECK(promkit::mux::ParseSketchMarker("-2:1", p) && p.sketch_schema == -2 && p.quantiles.size() == 1);
+  for (const char* bad : {"", "3", "3:", "3:0.5,", "3:1.5", "x:0.5", "3:0.5;0.9", "3,0.5"}) {
+    MergePolicy q;
+    PK_CHECK(!promkit::mux::ParseSketchMarker(bad, q) && q.quantiles.empty());
+  }
+}
+
+void SketchFormBecomesASummary() {
+  // Schema 0: bucket bounds are powers of two, a bucket's representative 2b/3.
+  // Two workers, no policy: the marker alone turns the merge back into a summary
+  const std::string a = "# TYPE s histogram\n"
+                        "s_bucket{component=\"a\",promkit_sketch=\"0:0.5\",le=\"1\"} 2\n"
+                        "s_bucket{component=\"a\",promkit_sketch=\"0:0.5\",le=\"+Inf\"} 3\n"
+                        "s_sum{component=\"a\",promkit_sketch=\"0:0.5\"} 2\n"
+                        "s_count{component=\"a\",promkit_sketch=\"0:0.5\"} 3\n";
+  const std::string b = "# TYPE s histogram\n"
+                        "s_bucket{component=\"b\",promkit_sketch=\"0:0.5\",le=\"4\"} 6\n"
+                        "s_bucket{component=\"b\",promkit_sketch=\"0:0.5\",le=\"+Inf\"} 6\n"
+                        "s_sum{component=\"b\",promkit_sketch=\"0:0.5\"} 20\n"
+                        "s_count{component=\"b\",promkit_sketch=\"0:0.5\"} 6\n";
+  MergeTable table;
+  for (const auto* text : {&a, &b}) {
+    for (auto& f : ParseTextExposition(*text)) table.Add(std::move(f));
+  }
+  const auto merged = table.Take();
+  PK_CHECK(merged.size() == 1 && merged[0].type == prometheus::MetricType::Summary);
+  PK_CHECK_EQ(Dump(merged), "summary s \"\"\n"
+                            "  {component=\"a\"} count=3 sum=2 [0.5:" + promkit::test::Num(2.0 / 3) + "]\n"
+                            "  {component=\"b\"} count=6 sum=20 [0.5:" + promkit::test::Num(8.0 / 3) + "]\n"
+                            "  {} count=9 sum=22 [0.5:" + promkit::test::Num(8.0 / 3) + "]\n");
+  // A policy's quantiles win over the marker's
+  MergePolicies policies;
+  policies["s"] = promkit::mux::MakeMergePolicy("summary", "sum_only", "");
+  policies["s"].quantiles = {0.1};
+  policies["s"].sketch_schema = 0;
+  PK_CHECK_EQ(Merge({a, b}, &policies), "summary s \"\"\n"
+                                        "  {} count=9 sum=22 [0.1:" + promkit::test::Num(2.0 / 3) + "]\n");
+}
+
+void PlainHistogramsStayHistograms() {
+  PK_CHECK_EQ(Merge({"# TYPE h histogram\nh_bucket{component=\"a\",le=\"+Inf\"} 1\nh_count{component=\"a\"} 1\n"}),
+              "histogram h \"\"\n"
+              "  {component=\"a\"} count=1 sum=0 [inf:1]\n"
+              "  {} count=1 sum=0 [inf:1]\n");
+}
+
+} // namespace
+
+int main() {
+  return promkit::test::Run({
+      {"CountersAreKeptAndSummed", CountersAreKeptAndSummed},
+      {"GaugesDefaultToPerProcess", GaugesDefaultToPerProcess},
+      {"GaugePolicies", GaugePolicies},
+      {"HistogramsWithSameBounds", HistogramsWithSameBounds},
+      {"HistogramsWithDifferentBounds", HistogramsWithDifferentBounds},
+      {"SummariesAreNeverSummed", SummariesAreNeverSummed},
+      {"SketchMarkers", SketchMarkers},
+      {"SketchFormBecomesASummary", SketchFormBecomesASummary},
+      {"PlainHistogramsStayHistograms", PlainHistogramsStayHistograms},
+  });
+}
@@ -0,0 +1,223 @@
+// Shared-memory segments: schema/values codec, writer/reader and requests
+#include "Check.hpp"
+#include "ShmSegment.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+
+using namespace promkit::mux;
+using promkit::test::Dump;
+
+namespace {
+
+std::vector<prometheus::MetricFamily> Sample(double scale = 1, const std::string& op = "get") {
+  using prometheus::MetricType;
+  std::vector<prometheus::MetricFamily> fams(5);
+  fams[0].name = "c_total";
+  fams[0].help = "a counter";
+  fams[0].type = MetricType::Counter;
+  auto& c = fams[0].metric.emplace_back();
+  c.label = {{"op", op}, {"quote", "a\"b\nc"}};
+  c.counter.value = 3 * scale;
+  fams[1].name = "g";
+  fams[1].type = MetricType::Gauge;
+  fams[1].metric.emplace_back().gauge.value = std::numeric_limits<double>::quiet_NaN();
+  fams[1].metric.emplace_back().gauge.value = -std::numeric_limits<double>::infinity();
+  fams[1].metric[1].label = {{"k", ""}};
+  fams[2].name = "u";
+  fams[2].type = MetricType::Untyped;
+  fams[2].metric.emplace_back().untyped.value = 7 * scale;
+  fams[3].name = "h";
+  fams[3].help = "a histogram";
+  fams[3].type = MetricType::Histogram;
+  auto& h = fams[3].metric.emplace_back().histogram;
+  h.sample_count = static_cast<std::uint64_t>(4 * scale);
+  h.sample_sum = 2.5 * scale;
+  h.bucket = {{static_cast<std::uint64_t>(1 * scale), 0.1}, {static_cast<std::uint64_t>(4 * scale), std::numeric_limits<double>::infinity()}};
+  fams[4].name = "s";
+  fams[4].type = MetricType::Summary;
+  auto& s = fams[4].metric.emplace_back().summary;
+  s.sample_count = 9;
+  s.sample_sum = 1.25 * scale;
+  s.quantile = {{0.5, 0.1 * scale}, {0.99, 0.9 * scale}};
+  return fams;
+}
+
+void CodecRoundTrip() {
+  const auto fams = Sample();
+  std::string schema, values;
+  EncodeSchema(fams, schema);
+  EncodeValues(fams, values);
+  std::vector<prometheus::MetricFamily> out;
+  PK_CHECK(DecodeSchema(schema, out));
+  PK_CHECK(ApplyValues(values, out));
+  PK_CHECK_EQ(Dump(out), Dump(fams));
+}
+
+void SchemaAloneHasZeroValues() {
+  std::string schema;
+  EncodeSchema(Sample(), schema);
+  std::vector<prometheus::MetricFamily> out;
+  PK_CHECK(DecodeSchema(schema, out));
+  PK_CHECK_EQ(Dump(out), "counter c_total \"a counter\"\n"
+                         "  {op=\"get\",quote=\"a\\\"b\\nc\"} 0\n"
+                         "gauge g \"\"\n"
+                         "  {} 0\n"
+                         "  {k=\"\"} 0\n"
+                         "untyped u \"\"\n"
+                         "  {} 0\n"
+                         "histogram h \"a histogram\"\n"
+                         "  {} count=0 sum=0 [0.1:0 inf:0]\n"
+                         "summary s \"\"\n"
+                         "  {} count=0 sum=0 [0.5:0 0.99:0]\n");
+}
+
+void MalformedSchemaIsRejected() {
+  std::string schema;
+  EncodeSchema(Sample(), schema);
+  std::vector<prometheus::MetricFamily> out;
+  for (std::size_t n = 0; n < schema.size(); ++n) PK_CHECK(!DecodeSchema(std::string_view(schema).substr(0, n), out));
+  PK_CHECK(!DecodeSchema(schema + '\0', out));
+  // Type byte of the first family: after the family count and two strings
+  auto bad = schema;
+  const std::size_t type_at = 4 + 4 + std::string("c_total").size() + 4 + std::string("a counter").size();
+  bad[type_at] = static_cast<char>(200);
+  PK_CHECK(!DecodeSchema(bad, out));
+  // A count larger than what follows must not allocate for it
+  std::string huge(4, '\xff');
+  PK_CHECK(!DecodeSchema(huge, out));
+}
+
+void MismatchedValuesAreRejected() {
+  const auto fams = Sample();
+  std::string schema, values;
+  EncodeSchema(fams, schema);
+  EncodeValues(fams, values);
+  std::vector<prometheus::MetricFamily> out;
+  PK_CHECK(DecodeSchema(schema, out));
+  PK_CHECK(!ApplyValues(std::string_view(values).substr(0, values.size() - 1), out));
+  PK_CHECK(!ApplyValues(std::string_view(values).substr(0, values.size() - 8), out));
+  PK_CHECK(!ApplyValues(values + std::string(8, '\0'), out));
+  PK_CHECK(ApplyValues(values, out));
+}
+
+#ifndef _WIN32
+
+std::string SegmentPath(const char* name) {
+  return (std::filesystem::temp_directory_path() / (std::string("promkit-test-") + name)).string();
+}
+
+void WriterAndReader() {
+  const auto path = SegmentPath("rw");
+  ShmWriter w;
+  PK_CHECK(w.Open(path, "comp", 42));
+  ShmReader r;
+  std::vector<prometheus::MetricFamily> out;
+  PK_CHECK(!r.Read(path, out)); // nothing published yet
+  PK_CHECK(w.Publish(Sample()));
+  PK_CHECK(r.Read(path, out));
+  PK_CHECK_EQ(Dump(out), Dump(Sample()));
+  // Same schema: only the values move
+  PK_CHECK(w.Publish(Sample(2)));
+  PK_CHECK(r.Read(path, out));
+  PK_CHECK_EQ(Dump(out), Dump(Sample(2)));
+  // New schema (another label value)
+  PK_CHECK(w.Publish(Sample(1, "put")));
+  PK_CHECK(r.Read(path, out));
+  PK_CHECK_EQ(Dump(out), Dump(Sample(1, "put")));
+  // A payload past the first mapping grows the segment
+  auto big = Sample();
+  for (int i = 0; i < 5000; ++i) {
+    auto m = big[0].metric[0];
+    m.label[0].value = std::to_string(i);
+    big[0].metric.push_back(std::move(m));
+  }
+  PK_CHECK(w.Publish(big));
+  PK_CHECK(r.Read(path, out));
+  PK_CHECK_EQ(Dump(out), Dump(big));
+  w.Close();
+  PK_CHECK(!std::filesystem::exists(path));
+  PK_CHECK(!r.Read(path, out));
+}
+
+void ReopenedSegmentIsDecodedAgain() {
+  const auto path = SegmentPath("reopen");
+  ShmReader r;
+  std::vector<prometheus::MetricFamily> out;
+  {
+    ShmWriter w;
+    PK_CHECK(w.Open(path, "comp", 1));
+    PK_CHECK(w.Publish(Sample(1, "old")));
+    PK_CHECK(r.Read(path, out));
+  }
+  ShmWriter w;
+  PK_CHECK(w.Open(path, "comp", 1));
+  PK_CHECK(w.Publish(Sample(1, "new")));
+  PK_CHECK(r.Read(path, out));
+  PK_CHECK_EQ(Dump(out), Dump(Sample(1, "new")));
+}
+
+void ForeignFileIsRejected() {
+  const auto path = SegmentPath("foreign");
+  {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    f << std::string(64 * 1024, 'x');
+  }
+  ShmReader r;
+  std::vector<prometheus::MetricFamily> out;
+  PK_CHECK(!r.Request(path));
+  PK_CHECK(!r.Read(path, out));
+  std::filesystem::remove(path);
+}
+
+void RequestsAreAnswered() {
+  using Clock = std::chrono::steady_clock;
+  const auto path = SegmentPath("request");
+  ShmWriter w;
+  PK_CHECK(w.Open(path, "comp", 1));
+  PK_CHECK(w.Publish(Sample(1)));
+  PK_CHECK(!w.WaitForRequest(std::chrono::milliseconds(0))); // nobody asked
+  ShmReader r;
+  std::vector<prometheus::MetricFamily> out;
+  // Unanswered: the last image once the deadline passes
+  PK_CHECK(r.Request(path));
+  PK_CHECK(r.Read(path, out, nullptr, Clock::now() + std::chrono::milliseconds(20)));
+  PK_CHECK(r.timed_out());
+  PK_CHECK_EQ(Dump(out), Dump(Sample(1)));
+  // The request stays pending for the writer until an image answers it
+  PK_CHECK(w.WaitForRequest(std::chrono::milliseconds(0)));
+  PK_CHECK(w.Publish(Sample(2)));
+  PK_CHECK(!w.WaitForRequest(std::chrono::milliseconds(0)));
+  PK_CHECK(r.Request(path));
+  PK_CHECK(w.WaitForRequest(std::chrono::milliseconds(0)));
+  PK_CHECK(w.Publish(Sample(3)));
+  PK_CHECK(r.Read(path, out, nullptr, Clock::now() + std::chrono::seconds(5)));
+  PK_CHECK(!r.timed_out());
+  PK_CHECK_EQ(Dump(out), Dump(Sample(3)));
+  // Without a Request, Read takes the latest image at once
+  PK_CHECK(r.Read(path, out));
+  PK_CHECK(!r.timed_out());
+}
+
+#endif
+
+} // namespace
+
+int main() {
+  return promkit::test::Run({
+      {"CodecRoundTrip", CodecRoundTrip},
+      {"SchemaAloneHasZeroValues", SchemaAloneHasZeroValues},
+      {"MalformedSchemaIsRejected", MalformedSchemaIsRejected},
+      {"MismatchedValuesAreRejected", MismatchedValuesAreRejected},
+#ifndef _WIN32
+      {"WriterAndReader", WriterAndReader},
+      {"ReopenedSegmentIsDecodedAgain", ReopenedSegmentIsDecodedAgain},
+      {"ForeignFileIsRejected", ForeignFileIsRejected},
+      {"RequestsAreAnswered", RequestsAreAnswered},
+#endif
+  });
+}
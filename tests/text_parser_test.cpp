@@ -0,0 +1,187 @@
+// ParseTextExposition: golden input -> families
+#include "Check.hpp"
+#include "FamilyPool.hpp"
+#include "TextParser.hpp"
+
+#include <string>
+
+using promkit::mux::ParseTextExposition;
+using promkit::test::Dump;
+
+namespace {
+
+void EscapedLabelValues() {
+  const auto fams = ParseTextExposition(
+      "# TYPE g gauge\n"
+      "g{quote=\"a\\\"b\",backslash=\"c:\\\\x\",newline=\"l1\\nl2\",comma=\"x,y\",brace=\"}\"} 1\n");
+  PK_CHECK(fams.size() == 1 && fams[0].metric.size() == 1);
+  if (fams.size() != 1 || fams[0].metric.size() != 1) return;
+  const auto& l = fams[0].metric[0].label;
+  PK_CHECK(l.size() == 5);
+  if (l.size() != 5) return;
+  PK_CHECK(l[0].value == "a\"b");
+  PK_CHECK(l[1].value == "c:\\x");
+  PK_CHECK(l[2].value == "l1\nl2");
+  PK_CHECK(l[3].value == "x,y");
+  PK_CHECK(l[4].value == "}");
+}
+
+void SpecialValues() {
+  PK_CHECK_EQ(Dump(ParseTextExposition("# TYPE g gauge\n"
+                                       "g{v=\"nan\"} NaN\n"
+                                       "g{v=\"pinf\"} +Inf\n"
+                                       "g{v=\"ninf\"} -Inf\n"
+                                       "g{v=\"exp\"} 1.5e-3\n"
+                                       "g{v=\"neg\"} -2\n")),
+              "gauge g \"\"\n"
+              "  {v=\"nan\"} nan\n"
+              "  {v=\"pinf\"} inf\n"
+              "  {v=\"ninf\"} -inf\n"
+              "  {v=\"exp\"} 0.0015\n"
+              "  {v=\"neg\"} -2\n");
+}
+
+void MissingHelpAndType() {
+  PK_CHECK_EQ(Dump(ParseTextExposition("plain 3\n"
+                                       "h_bucket{le=\"1\"} 1\n"
+                                       "h_bucket{le=\"+Inf\"} 2\n"
+                                       "h_sum 0.75\n"
+                                       "h_count 2\n")),
+              "untyped plain \"\"\n"
+              "  {} 3\n"
+              "histogram h \"\"\n"
+              "  {} count=2 sum=0.75 [1:1 inf:2]\n");
+}
+
+void HelpAndTypeInEitherOrder() {
+  PK_CHECK_EQ(Dump(ParseTextExposition("# TYPE a counter\n"
+                                       "# HELP a first\n"
+                                       "a 1\n"
+                                       "# HELP b with \\\\ and \\n escapes\n"
+                                       "# TYPE b gauge\n"
+                                       "b 2\n"
+                                       "# some other comment\n")),
+              "counter a \"first\"\n"
+              "  {} 1\n"
+              "gauge b \"with \\\\ and \\n escapes\"\n"
+              "  {} 2\n");
+}
+
+void InterleavedFamilies() {
+  PK_CHECK_EQ(Dump(ParseTextExposition("# TYPE a counter\n"
+                                       "# TYPE b gauge\n"
+                                       "# TYPE h histogram\n"
+                                       "a{x=\"1\"} 1\n"
+                                       "b 2\n"
+                                       "h_bucket{k=\"1\",le=\"1\"} 1\n"
+                                       "a{x=\"2\"} 3\n"
+                                       "h_bucket{k=\"2\",le=\"+Inf\"} 4\n"
+                                       "h_bucket{k=\"1\",le=\"+Inf\"} 2\n"
+                                       "h_count{k=\"1\"} 2\n"
+                                       "h_count{k=\"2\"} 4\n")),
+              "counter a \"\"\n"
+              "  {x=\"1\"} 1\n"
+              "  {x=\"2\"} 3\n"
+              "gauge b \"\"\n"
+              "  {} 2\n"
+              "histogram h \"\"\n"
+              "  {k=\"1\"} count=2 sum=0 [1:1 inf:2]\n"
+              "  {k=\"2\"} count=4 sum=0 [inf:4]\n");
+}
+
+void TrailingTimestamps() {
+  PK_CHECK_EQ(Dump(ParseTextExposition("# TYPE c counter\n"
+                                       "c{k=\"v\"} 5 1700000000000\n"
+                                       "c{k=\"w\"}\t6\t1700000000000\n")),
+              "counter c \"\"\n"
+              "  {k=\"v\"} 5\n"
+              "  {k=\"w\"} 6\n");
+}
+
+void CrlfInput() {
+  PK_CHECK_EQ(Dump(ParseTextExposition("# HELP c help\r\n"
+                                       "# TYPE c counter\r\n"
+                                       "c{k=\"v\"} 5\r\n"
+                                       "\r\n"
+                                       "c{k=\"w\"} 6\r\n")),
+              "counter c \"help\"\n"
+              "  {k=\"v\"} 5\n"
+              "  {k=\"w\"} 6\n");
+}
+
+void Summaries() {
+  PK_CHECK_EQ(Dump(ParseTextExposition("# HELP s latency\n"
+                                       "# TYPE s summary\n"
+                                       "s{op=\"get\",quantile=\"0.5\"} 1\n"
+                                       "s{op=\"get\",quantile=\"0.99\"} 2.5\n"
+                                       "s_sum{op=\"get\"} 10\n"
+                                       "s_count{op=\"get\"} 4\n")),
+              "summary s \"latency\"\n"
+              "  {op=\"get\"} count=4 sum=10 [0.5:1 0.99:2.5]\n");
+}
+
+void UnsortedBucketsAreSorted() {
+  PK_CHECK_EQ(Dump(ParseTextExposition("# TYPE h histogram\n"
+                                       "h_bucket{le=\"+Inf\"} 3\n"
+                                       "h_bucket{le=\"0.5\"} 1\n"
+                                       "h_bucket{le=\"0.1\"} 0\n"
+                                       "h_sum 1\n"
+                                       "h_count 3\n")),
+              "histogram h \"\"\n"
+              "  {} count=3 sum=1 [0.1:0 0.5:1 inf:3]\n");
+}
+
+void MalformedLinesAreSkipped() {
+  PK_CHECK_EQ(Dump(ParseTextExposition("# TYPE g gauge\n"
+                                       "g{x=\"1\" 2\n"      // unterminated label set
+                                       "g{x=\"1} 2\n"       // unterminated value
+                                       "g{x=1} 2\n"         // unquoted value
+                                       "g\n"                // no value
+                                       "g abc\n"            // not a number
+                                       "g 1.5x\n"           // trailing garbage in the value
+                                       "{x=\"1\"} 2\n"      // no name
+                                       "g{x=\"ok\"} 7\n")),
+              "gauge g \"\"\n"
+              "  {x=\"ok\"} 7\n");
+}
+
+void EmptyInput() {
+  PK_CHECK(ParseTextExposition("").empty());
+  PK_CHECK(ParseTextExposition("\n\n# just a comment\n").empty());
+}
+
+void PoolDoesNotChangeTheResult() {
+  const std::string text = "# HELP a a counter\n# TYPE a counter\na{x=\"1\"} 1\na{x=\"2\"} 2\n"
+                           "# TYPE h histogram\nh_bucket{le=\"1\"} 1\nh_bucket{le=\"+Inf\"} 2\nh_sum 3\nh_count 2\n"
+                           "# TYPE s summary\ns{quantile=\"0.5\"} 1\ns_sum 2\ns_count 3\n";
+  const auto plain = Dump(ParseTextExposition(text));
+  promkit::mux::FamilyPool pool;
+  for (int round = 0; round < 3; ++round) {
+    auto fams = ParseTextExposition(text, &pool);
+    PK_CHECK_EQ(Dump(fams), plain);
+    pool.Recycle(std::move(fams));
+  }
+  // Spares of a bigger image do not leak into a smaller one
+  auto big = ParseTextExposition(text, &pool);
+  pool.Recycle(std::move(big));
+  PK_CHECK_EQ(Dump(ParseTextExposition("# TYPE g gauge\ng 1\n", &pool)), "gauge g \"\"\n  {} 1\n");
+}
+
+} // namespace
+
+int main() {
+  return promkit::test::Run({
+      {"EscapedLabelValues", EscapedLabelValues},
+      {"SpecialValues", SpecialValues},
+      {"MissingHelpAndType", MissingHelpAndType},
+      {"HelpAndTypeInEitherOrder", HelpAndTypeInEitherOrder},
+      {"InterleavedFamilies", InterleavedFamilies},
+      {"TrailingTimestamps", TrailingTimestamps},
+      {"CrlfInput", CrlfInput},
+      {"Summaries", Summaries},
+      {"UnsortedBucketsAreSorted", UnsortedBucketsAreSorted},
+      {"MalformedLinesAreSkipped", MalformedLinesAreSkipped},
+      {"EmptyInput", EmptyInput},
+      {"PoolDoesNotChangeTheResult", PoolDoesNotChangeTheResult},
+  });
+}